@@ -0,0 +1,121 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// counts heap allocations made through operator new. the replacement operators are only
+// compiled with OPENGL_COUNT_ALLOCATIONS defined (cmake -DCOUNT_ALLOCATIONS=ON), and the
+// header may then be included by one translation unit only. the counter is atomic, the
+// LightBaker's worker threads allocate through the same operators.
+class AllocationCounter
+{
+public:
+    static bool enabled()
+    {
+#ifdef OPENGL_COUNT_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // allocations since the program started, stays 0 when counting is disabled
+    static std::atomic<unsigned long> &allocations()
+    {
+        static std::atomic<unsigned long> counter(0);
+        return counter;
+    }
+};
+
+#ifdef OPENGL_COUNT_ALLOCATIONS
+void *operator new(std::size_t size)
+{
+    AllocationCounter::allocations()++;
+    if(void *p = std::malloc(size != 0 ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    AllocationCounter::allocations()++;
+    return std::malloc(size != 0 ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+// over-aligned types, the alignment is a power of two
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    AllocationCounter::allocations()++;
+    std::size_t align = static_cast<std::size_t>(alignment);
+    // aligned_alloc needs a size that is a multiple of the alignment
+    size = (std::max<std::size_t>(size, 1) + align - 1) / align * align;
+#ifdef _WIN32
+    void *p = _aligned_malloc(size, align);
+#else
+    void *p = std::aligned_alloc(align, size);
+#endif
+    if(p)
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    try
+    {
+        return operator new(size, alignment);
+    }
+    catch(const std::bad_alloc &)
+    {
+        return nullptr;
+    }
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, alignment, tag);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+
+// over-aligned blocks come from _aligned_malloc on Windows, which has its own free
+#ifdef _WIN32
+#define ALLOCATION_COUNTER_ALIGNED_FREE _aligned_free
+#else
+#define ALLOCATION_COUNTER_ALIGNED_FREE std::free
+#endif
+void operator delete(void *p, std::align_val_t) noexcept { ALLOCATION_COUNTER_ALIGNED_FREE(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { ALLOCATION_COUNTER_ALIGNED_FREE(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { ALLOCATION_COUNTER_ALIGNED_FREE(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { ALLOCATION_COUNTER_ALIGNED_FREE(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { ALLOCATION_COUNTER_ALIGNED_FREE(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { ALLOCATION_COUNTER_ALIGNED_FREE(p); }
+#endif
+
+#endif
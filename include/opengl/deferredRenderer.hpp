@@ -0,0 +1,125 @@
+#ifndef DEFERREDRENDERER_H
+#define DEFERREDRENDERER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <opengl/shader.hpp>
+#include <opengl/shaderPreprocessor.hpp>
+#include <opengl/drawQueue.hpp>
+#include <opengl/screenQuad.hpp>
+#include <opengl/shadowAtlas.hpp>
+#include <opengl/camera.hpp>
+#include <opengl/glState.hpp>
+
+#include <iostream>
+
+#define GBUFFER_VERTEX_SHADER_PATH "../resources/shaders/model_lighting.vs"
+#define GBUFFER_FRAGMENT_SHADER_PATH "../resources/shaders/gbuffer.fs"
+#define DEFERRED_LIGHTING_VERTEX_SHADER_PATH "../resources/shaders/screen_quad.vs"
+#define DEFERRED_LIGHTING_FRAGMENT_SHADER_PATH "../resources/shaders/deferred_lighting.fs"
+
+// draws opaque geometry in two passes: the geometry pass writes albedo, specular and a
+// packed normal into a G-buffer, then one fullscreen pass lights every covered pixel
+// with the lights of its cluster. lighting cost follows the pixels and the lights that
+// reach them instead of the overdraw. the lighting pass writes the scene depth into the
+// target framebuffer, so mirrors and the skybox are drawn forward over the lit result.
+// see gbuffer.glsl for the layout.
+class DeferredRenderer
+{
+public:
+    // both programs are built deferred, Draw skips the pass until they are ready.
+    // lightingDefines are the light defines, materialDefines those of the material table.
+    DeferredRenderer(const ShaderDefines &lightingDefines, const ShaderDefines &materialDefines)
+        : geometryShader(Shader(GBUFFER_VERTEX_SHADER_PATH, GBUFFER_FRAGMENT_SHADER_PATH, nullptr, materialDefines, true)),
+          lightingShaders(DEFERRED_LIGHTING_VERTEX_SHADER_PATH, DEFERRED_LIGHTING_FRAGMENT_SHADER_PATH)
+    {
+        setLightDefines(lightingDefines);
+        glGenFramebuffers(1, &framebuffer);
+    }
+
+    // selects the lighting program for changed light defines, built deferred if new
+    void setLightDefines(const ShaderDefines &lightingDefines)
+    {
+        lightingShader = &lightingShaders.get(lightingDefines, true);
+    }
+
+    bool isReady()
+    {
+        // both are polled, so both finish without blocking
+        bool geometryReady = geometryShader.isReady();
+        bool lightingReady = lightingShader->isReady();
+        return geometryReady && lightingReady;
+    }
+
+    // draws the queued meshes and lights them into target, frame constants and lights
+    // bound. the G-buffer follows the camera's resolution.
+    void Draw(DrawQueue &queue, Camera &camera, GLuint target = 0)
+    {
+        resize(static_cast<GLsizei>(camera.resolution.x), static_cast<GLsizei>(camera.resolution.y));
+        GLState &state = GLState::instance();
+
+        // geometry pass, opaque and unblended
+        state.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        state.setEnabled(GL_BLEND, false);
+        geometryShader.use();
+        queue.Draw(geometryShader);
+
+        // lighting pass
+        state.bindFramebuffer(GL_FRAMEBUFFER, target);
+        lightingShader->use();
+        ShadowAtlas::bind(*lightingShader);
+        lightingShader->bindTexture("gbuffer_albedo", GL_TEXTURE_2D, albedoTexture);
+        lightingShader->bindTexture("gbuffer_normal", GL_TEXTURE_2D, normalTexture);
+        lightingShader->bindTexture("gbuffer_depth", GL_TEXTURE_2D, depthTexture);
+        quad.DrawFullscreen();
+        state.setEnabled(GL_BLEND, true);
+    }
+
+private:
+    Shader geometryShader;
+    ShaderPermutations lightingShaders;
+    Shader *lightingShader = nullptr;
+    ScreenQuad quad;
+    GLuint framebuffer;
+    GLuint albedoTexture = 0, normalTexture = 0, depthTexture = 0;
+    GLsizei width = 0, height = 0;
+
+    // reallocates the attachments when the resolution changes
+    void resize(GLsizei newWidth, GLsizei newHeight)
+    {
+        if(newWidth == width && newHeight == height)
+            return;
+        width = newWidth;
+        height = newHeight;
+        GLState &state = GLState::instance();
+        for(GLuint *texture : {&albedoTexture, &normalTexture, &depthTexture})
+            if(*texture != 0)
+                state.deleteTexture(*texture);
+
+        albedoTexture = createAttachment(GL_RGBA8);
+        normalTexture = createAttachment(GL_RG16_SNORM);
+        depthTexture = createAttachment(GL_DEPTH_COMPONENT32F);
+        glNamedFramebufferTexture(framebuffer, GL_COLOR_ATTACHMENT0, albedoTexture, 0);
+        glNamedFramebufferTexture(framebuffer, GL_COLOR_ATTACHMENT1, normalTexture, 0);
+        glNamedFramebufferTexture(framebuffer, GL_DEPTH_ATTACHMENT, depthTexture, 0);
+        const GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glNamedFramebufferDrawBuffers(framebuffer, 2, drawBuffers);
+        if(glCheckNamedFramebufferStatus(framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::DEFERREDRENDERER::INCOMPLETE_GBUFFER" << std::endl;
+    }
+
+    GLuint createAttachment(GLenum format)
+    {
+        GLuint texture;
+        glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+        glTextureStorage2D(texture, 1, format, width, height);
+        // read with texelFetch only
+        glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return texture;
+    }
+};
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef DRAWQUEUE_H
+#define DRAWQUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <opengl/shader.hpp>
+#include <opengl/mesh.hpp>
+#include <opengl/geometryBuffer.hpp>
+#include <opengl/objectBuffer.hpp>
+#include <opengl/materialLibrary.hpp>
+#include <opengl/glState.hpp>
+#include <opengl/frameArena.hpp>
+
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+// shader storage binding of the per-draw data, see drawData.glsl
+#define DRAW_DATA_BINDING 3
+
+// per-draw data, fetched in the vertex shader with GL_DrawOffset + gl_DrawID
+struct DrawData
+{
+    // transform slot in the ObjectBuffer
+    unsigned int object;
+    // free for the pass, the mirror passes store the plane index here
+    unsigned int id;
+    // material id, the index of the material's record in the MaterialLibrary
+    unsigned int material;
+    // bytes per index of the draw's index pool, read by the visibility resolve
+    unsigned int indexSize;
+};
+
+// collects the draws of one pass and submits them with as few glMultiDrawElementsIndirect
+// calls as possible: one per (vertex format, index width, material). programs that read
+// the material table or sample no textures at all have their draws merged across materials.
+// every pass should own its queue, the buffers are rewritten on each Draw.
+class DrawQueue
+{
+public:
+    DrawQueue()
+    {
+        glGenBuffers(1, &commandBuffer);
+        glGenBuffers(1, &drawDataBuffer);
+    }
+
+    void clear()
+    {
+        items.clear();
+    }
+
+    bool empty() const
+    {
+        return items.empty();
+    }
+
+    // commands submitted by the last Draw, GL_Draw and getCommandBuffer() hold as many
+    size_t drawCount() const
+    {
+        return commands.size();
+    }
+
+    // the commands of the last Draw in submission order, indexed like GL_Draw
+    GLuint getCommandBuffer() const
+    {
+        return commandBuffer;
+    }
+
+    void add(Mesh &mesh, int lod, unsigned int object, unsigned int id = 0)
+    {
+        Item item;
+        item.mesh = &mesh;
+        item.lod = lod;
+        item.data.object = object;
+        item.data.id = id;
+        item.data.material = mesh.material.id;
+        items.push_back(item);
+    }
+
+    // submits the queued draws. depthOnly draws the position streams and binds no textures.
+    void Draw(Shader &shader, bool depthOnly = false)
+    {
+        if(items.empty())
+            return;
+
+        // group draws that can share a multi-draw
+        bool bindTextures = !depthOnly && !shader.usesMaterialTable() && shader.usesSamplers();
+        for(Item &item : items)
+        {
+            Mesh &mesh = *item.mesh;
+            bool depth = depthOnly && mesh.depthVAO != 0;
+            item.indexType = depth ? mesh.depthIndexType : mesh.indexType;
+            item.vao = depth ? mesh.depthVAO : mesh.VAO;
+            item.command = depthOnly ? mesh.getDepthCommand() : mesh.getCommand(item.lod);
+            item.data.indexSize = static_cast<unsigned int>(GeometryBuffer::indexSize(item.indexType));
+        }
+        // sorted through keys in the frame arena, the queue position keeps equal draws in
+        // order without the buffer std::stable_sort would allocate on every pass
+        SortKey *keys = FrameArena::instance().allocate<SortKey>(items.size());
+        for(size_t i = 0; i < items.size(); i++)
+            keys[i] = {items[i].vao, bindTextures ? items[i].mesh->material.id : 0u, static_cast<unsigned int>(i)};
+        std::sort(keys, keys + items.size(), [](const SortKey &a, const SortKey &b)
+        {
+            if(a.vao != b.vao)
+                return a.vao < b.vao;
+            if(a.material != b.material)
+                return a.material < b.material;
+            return a.index < b.index;
+        });
+
+        commands.clear();
+        drawData.clear();
+        batches.clear();
+        for(size_t i = 0; i < items.size(); i++)
+        {
+            const Item &item = items[keys[i].index];
+            if(item.command.count == 0)
+                continue;
+            if(batches.empty() || !sameBatch(*batches.back().first, item, bindTextures))
+                batches.push_back({&item, static_cast<unsigned int>(commands.size()), 0u});
+            batches.back().count++;
+            commands.push_back(item.command);
+            drawData.push_back(item.data);
+        }
+        if(commands.empty())
+            return;
+
+        upload(GL_DRAW_INDIRECT_BUFFER, commandBuffer, commandCapacity, commands.data(), commands.size() * sizeof(DrawElementsIndirectCommand));
+        upload(GL_SHADER_STORAGE_BUFFER, drawDataBuffer, drawDataCapacity, drawData.data(), drawData.size() * sizeof(DrawData));
+        GLState &state = GLState::instance();
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+        // transforms of this frame, copied by ObjectBuffer::flush
+        ObjectBuffer::instance().bind();
+        if(shader.usesMaterialTable())
+            MaterialLibrary::instance().bind(shader);
+
+        state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        for(const Batch &batch : batches)
+        {
+            if(bindTextures)
+                shader.bindMaterial(batch.first->mesh->material);
+            shader.set(shader.drawOffsetUniform, batch.firstDraw);
+            state.bindVertexArray(batch.first->vao);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, batch.first->indexType,
+                                        (void*)(batch.firstDraw * sizeof(DrawElementsIndirectCommand)),
+                                        batch.count, sizeof(DrawElementsIndirectCommand));
+        }
+    }
+
+private:
+    struct Item
+    {
+        Mesh *mesh;
+        int lod;
+        DrawData data;
+        // filled when the queue is drawn
+        GLuint vao;
+        GLenum indexType;
+        DrawElementsIndirectCommand command;
+    };
+
+    struct SortKey
+    {
+        GLuint vao;
+        unsigned int material;
+        unsigned int index;
+    };
+
+    struct Batch
+    {
+        const Item *first;
+        unsigned int firstDraw;
+        unsigned int count;
+    };
+
+    vector<Item> items;
+    vector<DrawElementsIndirectCommand> commands;
+    vector<DrawData> drawData;
+    vector<Batch> batches;
+
+    GLuint commandBuffer, drawDataBuffer;
+    size_t commandCapacity = 0, drawDataCapacity = 0;
+
+    static bool sameBatch(const Item &a, const Item &b, bool bindTextures)
+    {
+        return a.vao == b.vao && (!bindTextures || a.mesh->sameMaterial(*b.mesh));
+    }
+
+    // reallocates only when the data outgrows the buffer
+    static void upload(GLenum target, GLuint buffer, size_t &capacity, const void *data, size_t size)
+    {
+        GLState::instance().bindBuffer(target, buffer);
+        if(size > capacity)
+        {
+            capacity = size * 2;
+            glBufferData(target, capacity, NULL, GL_DYNAMIC_DRAW);
+        }
+        glBufferSubData(target, 0, size, data);
+    }
+};
+
+#endif
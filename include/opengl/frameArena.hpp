@@ -0,0 +1,77 @@
+#ifndef FRAMEARENA_H
+#define FRAMEARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#define FRAME_ARENA_INITIAL_SIZE (256 * 1024)
+
+// linear allocator for data that lives until the end of the frame. allocations bump a
+// pointer and are never freed one by one, reset() releases all of them at once.
+// when a frame needs more than the arena holds, the overflow comes from extra blocks,
+// and the next reset() grows the arena to the frame's peak so later frames fit again.
+class FrameArena
+{
+public:
+    static FrameArena &instance()
+    {
+        static FrameArena arena;
+        return arena;
+    }
+
+    // uninitialized storage for count objects of T, T must be trivially destructible
+    template<typename T>
+    T *allocate(size_t count)
+    {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void *allocate(size_t size, size_t alignment)
+    {
+        size_t offset = (used + alignment - 1) / alignment * alignment;
+        if(offset + size <= capacity)
+        {
+            used = offset + size;
+            peak = std::max(peak, used + overflowSize);
+            return memory.get() + offset;
+        }
+        // overflow block, aligned by operator new[] for any fundamental type
+        overflow.emplace_back(new char[size + alignment]);
+        overflowSize += size + alignment;
+        peak = std::max(peak, used + overflowSize);
+        char *block = overflow.back().get();
+        return block + (alignment - reinterpret_cast<uintptr_t>(block) % alignment) % alignment;
+    }
+
+    // call once per frame, every pointer handed out before is invalid afterwards
+    void reset()
+    {
+        if(!overflow.empty())
+        {
+            overflow.clear();
+            capacity = std::max(capacity * 2, peak);
+            memory.reset(new char[capacity]);
+        }
+        used = 0;
+        overflowSize = 0;
+        peak = 0;
+    }
+
+    size_t size() const
+    {
+        return capacity;
+    }
+
+private:
+    std::unique_ptr<char[]> memory;
+    std::vector<std::unique_ptr<char[]>> overflow;
+    size_t capacity = FRAME_ARENA_INITIAL_SIZE;
+    size_t used = 0, overflowSize = 0, peak = 0;
+
+    FrameArena() : memory(new char[FRAME_ARENA_INITIAL_SIZE]) {}
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef FRAMECONSTANTS_H
+#define FRAMECONSTANTS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <opengl/camera.hpp>
+#include <opengl/light.hpp>
+#include <opengl/glState.hpp>
+#include <opengl/ringBuffer.hpp>
+
+// uniform buffer binding of the frame constants, see frame.glsl
+#define FRAME_CONSTANTS_BINDING 0
+
+// std140 layout of GL_FRAME_CONSTANTS, only vec4 and mat4 members so no padding rules apply
+struct FrameConstantsData
+{
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::mat4 viewProjection;
+    glm::vec4 cameraPos;
+    // xy: size in pixels, zw: 1 / size
+    glm::vec4 screenResolution;
+    glm::vec4 ambientLight;
+    glm::vec4 directionalLightDirection;
+    // rgb: color, a: intensity
+    glm::vec4 directionalLightColor;
+    // x: point lights, y: spot lights
+    glm::uvec4 lightCount;
+    // x: near plane, y: far plane
+    glm::vec4 cameraClip;
+    glm::mat4 inverseViewProjection;
+    // irradiance SH, see LightManager::setAmbientIrradiance
+    glm::vec4 ambientSH[9];
+};
+
+// camera and lighting constants shared by every program. updated once per frame
+// and bound at a fixed binding point, so programs only receive per-object data.
+class FrameConstants
+{
+public:
+    FrameConstantsData data;
+
+    FrameConstants()
+    {
+        ring.reserve(sizeof(FrameConstantsData));
+    }
+
+    void update(Camera &camera, LightManager &lightManager)
+    {
+        data.projection = glm::perspective(glm::radians(camera.Zoom), camera.aspect, camera.near, camera.far);
+        data.view = camera.GetViewMatrix();
+        data.viewProjection = data.projection * data.view;
+        data.inverseViewProjection = glm::inverse(data.viewProjection);
+        data.cameraPos = glm::vec4(camera.Position, 1.0f);
+        data.screenResolution = glm::vec4(camera.resolution, 1.0f / camera.resolution);
+
+        const DirectionalLight &directional = lightManager.getDirectionalLight();
+        data.ambientLight = glm::vec4(lightManager.getAmbientLight(), 1.0f);
+        data.directionalLightDirection = glm::vec4(directional.direction, 0.0f);
+        data.directionalLightColor = glm::vec4(directional.color, directional.intensity);
+        data.lightCount = glm::uvec4(lightManager.getPointLightCount(), lightManager.getSpotLightCount(), 0, 0);
+        data.cameraClip = glm::vec4(camera.near, camera.far, 0.0f, 0.0f);
+        for(int i = 0; i < 9; i++)
+            data.ambientSH[i] = glm::vec4(lightManager.getAmbientIrradiance()[i], 0.0f);
+
+        ring.write(&data, sizeof(FrameConstantsData));
+        bind();
+    }
+
+    void bind()
+    {
+        ring.bindBase(FRAME_CONSTANTS_BINDING);
+    }
+
+private:
+    RingBuffer ring = RingBuffer(GL_UNIFORM_BUFFER);
+};
+
+#endif
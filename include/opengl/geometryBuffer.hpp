@@ -0,0 +1,229 @@
+#ifndef GEOMETRYBUFFER_H
+#define GEOMETRYBUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <opengl/vertex.hpp>
+#include <opengl/glState.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+// initial pool sizes in bytes, pools double when they run out
+#define GEOMETRY_VERTEX_POOL_SIZE (8 << 20)
+#define GEOMETRY_INDEX_POOL_SIZE (4 << 20)
+
+enum VertexFormat {
+    // the interleaved Vertex
+    VERTEX_FORMAT_FULL,
+    // tightly packed positions of the depth stream
+    VERTEX_FORMAT_POSITION,
+    VERTEX_FORMAT_COUNT
+};
+
+// command layout read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    unsigned int count;
+    unsigned int instanceCount;
+    unsigned int firstIndex;
+    int          baseVertex;
+    unsigned int baseInstance;
+};
+
+// all static mesh data lives in a few large buffers: one vertex pool per vertex format
+// and one index pool per index width. meshes only keep offsets into them, and there is
+// a single VAO per (vertex format, index width), so whole passes can be drawn with
+// glMultiDrawElementsIndirect.
+class GeometryBuffer
+{
+public:
+    // the pools are created on first use, a GL context must be current by then
+    static GeometryBuffer &instance()
+    {
+        static GeometryBuffer buffer;
+        return buffer;
+    }
+
+    // appends vertices of the given format, returns the base vertex of the first one
+    int addVertices(VertexFormat format, const void *data, size_t count)
+    {
+        size_t stride = vertexStride(format);
+        Pool &pool = vertexPools[format];
+        size_t offset = allocate(pool, count * stride, stride);
+        GLState::instance().bindBuffer(GL_COPY_WRITE_BUFFER, pool.buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, offset, count * stride, data);
+        return static_cast<int>(offset / stride);
+    }
+
+    // appends indices relative to the mesh's base vertex, stored with the given width.
+    // returns the first index inside the pool of that width.
+    unsigned int addIndices(const vector<unsigned int> &indices, GLenum indexType)
+    {
+        Pool &pool = indexPools[indexSlot(indexType)];
+        size_t size = indexSize(indexType);
+        size_t offset = allocate(pool, indices.size() * size, size);
+        GLState::instance().bindBuffer(GL_COPY_WRITE_BUFFER, pool.buffer);
+        if(indexType == GL_UNSIGNED_SHORT)
+        {
+            vector<uint16_t> narrow(indices.begin(), indices.end());
+            glBufferSubData(GL_COPY_WRITE_BUFFER, offset, narrow.size() * size, narrow.data());
+        }
+        else
+        {
+            glBufferSubData(GL_COPY_WRITE_BUFFER, offset, indices.size() * size, indices.data());
+        }
+        return static_cast<unsigned int>(offset / size);
+    }
+
+    GLuint getVAO(VertexFormat format, GLenum indexType)
+    {
+        return vaos[format][indexSlot(indexType)];
+    }
+
+    GLuint getVertexBuffer(VertexFormat format)
+    {
+        return vertexPools[format].buffer;
+    }
+
+    GLuint getIndexBuffer(GLenum indexType)
+    {
+        return indexPools[indexSlot(indexType)].buffer;
+    }
+
+    static size_t indexSize(GLenum indexType)
+    {
+        return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+    }
+
+    static size_t vertexStride(VertexFormat format)
+    {
+        return format == VERTEX_FORMAT_FULL ? sizeof(Vertex) : sizeof(glm::vec3);
+    }
+
+private:
+    struct Pool {
+        GLuint buffer = 0;
+        size_t used = 0;
+        size_t capacity = 0;
+    };
+    Pool vertexPools[VERTEX_FORMAT_COUNT];
+    Pool indexPools[2];
+    GLuint vaos[VERTEX_FORMAT_COUNT][2];
+
+    GeometryBuffer()
+    {
+        for(int f = 0; f < VERTEX_FORMAT_COUNT; f++)
+            createPool(vertexPools[f], GEOMETRY_VERTEX_POOL_SIZE);
+        for(int i = 0; i < 2; i++)
+            createPool(indexPools[i], GEOMETRY_INDEX_POOL_SIZE);
+
+        for(int f = 0; f < VERTEX_FORMAT_COUNT; f++)
+        {
+            for(int i = 0; i < 2; i++)
+            {
+                glGenVertexArrays(1, &vaos[f][i]);
+                GLState::instance().bindVertexArray(vaos[f][i]);
+                setupAttributes(static_cast<VertexFormat>(f));
+            }
+        }
+        bindPools();
+    }
+
+    static int indexSlot(GLenum indexType)
+    {
+        return indexType == GL_UNSIGNED_SHORT ? 0 : 1;
+    }
+
+    static void createPool(Pool &pool, size_t capacity)
+    {
+        glGenBuffers(1, &pool.buffer);
+        GLState::instance().bindBuffer(GL_COPY_WRITE_BUFFER, pool.buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STATIC_DRAW);
+        pool.used = 0;
+        pool.capacity = capacity;
+    }
+
+    // returns the byte offset of a new range, aligned to 'alignment'
+    size_t allocate(Pool &pool, size_t bytes, size_t alignment)
+    {
+        size_t offset = (pool.used + alignment - 1) / alignment * alignment;
+        if(offset + bytes > pool.capacity)
+        {
+            size_t capacity = pool.capacity;
+            while(offset + bytes > capacity)
+                capacity *= 2;
+            grow(pool, capacity);
+        }
+        pool.used = offset + bytes;
+        return offset;
+    }
+
+    // moves a pool into a larger buffer and points the VAOs at it
+    void grow(Pool &pool, size_t capacity)
+    {
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        GLState &state = GLState::instance();
+        state.bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STATIC_DRAW);
+        state.bindBuffer(GL_COPY_READ_BUFFER, pool.buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, pool.used);
+        state.deleteBuffer(pool.buffer);
+        pool.buffer = buffer;
+        pool.capacity = capacity;
+        bindPools();
+    }
+
+    void bindPools()
+    {
+        for(int f = 0; f < VERTEX_FORMAT_COUNT; f++)
+        {
+            for(int i = 0; i < 2; i++)
+            {
+                GLState::instance().bindVertexArray(vaos[f][i]);
+                glBindVertexBuffer(0, vertexPools[f].buffer, 0, static_cast<GLsizei>(vertexStride(static_cast<VertexFormat>(f))));
+                GLState::instance().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexPools[i].buffer);
+            }
+        }
+    }
+
+    // attribute layout of each format, all attributes read from vertex buffer binding 0
+    static void setupAttributes(VertexFormat format)
+    {
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
+        glVertexAttribBinding(0, 0);
+        if(format == VERTEX_FORMAT_POSITION)
+            return;
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Normal));
+        glVertexAttribBinding(1, 0);
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribFormat(2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, TexCoords));
+        glVertexAttribBinding(2, 0);
+        // vertex tangent
+        glEnableVertexAttribArray(3);
+        glVertexAttribFormat(3, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Tangent));
+        glVertexAttribBinding(3, 0);
+        // vertex bitangent
+        glEnableVertexAttribArray(4);
+        glVertexAttribFormat(4, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Bitangent));
+        glVertexAttribBinding(4, 0);
+        // ids
+        glEnableVertexAttribArray(5);
+        glVertexAttribIFormat(5, 4, GL_INT, offsetof(Vertex, m_BoneIDs));
+        glVertexAttribBinding(5, 0);
+        // weights
+        glEnableVertexAttribArray(6);
+        glVertexAttribFormat(6, 4, GL_FLOAT, GL_FALSE, offsetof(Vertex, m_Weights));
+        glVertexAttribBinding(6, 0);
+    }
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef GLEXTENSIONS_H
+#define GLEXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <iostream>
+
+// optional extensions the glad loader in this repository was not generated with.
+// GLExtensions::load must be called once after gladLoadGLLoader.
+
+// GL_KHR_parallel_shader_compile / GL_ARB_parallel_shader_compile
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// GL_ARB_bindless_texture, only the texture handle entry points
+typedef GLuint64 (APIENTRYP PFNGLGETTEXTUREHANDLEARBPROC)(GLuint texture);
+typedef void (APIENTRYP PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)(GLuint64 handle);
+
+class GLExtensions
+{
+public:
+    // compile and link status can be polled with GL_COMPLETION_STATUS_KHR without blocking
+    static bool parallelShaderCompile;
+    static PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads;
+    // textures can be sampled through resident 64 bit handles instead of bound units
+    static bool bindlessTexture;
+    static PFNGLGETTEXTUREHANDLEARBPROC getTextureHandle;
+    static PFNGLMAKETEXTUREHANDLERESIDENTARBPROC makeTextureHandleResident;
+
+    static void load(GLADloadproc loader)
+    {
+        if(supported("GL_KHR_parallel_shader_compile"))
+            maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)loader("glMaxShaderCompilerThreadsKHR");
+        else if(supported("GL_ARB_parallel_shader_compile"))
+            maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)loader("glMaxShaderCompilerThreadsARB");
+        parallelShaderCompile = maxShaderCompilerThreads != nullptr;
+        // let the driver pick the number of compiler threads
+        if(parallelShaderCompile)
+            maxShaderCompilerThreads(0xFFFFFFFFu);
+        std::cout << "Parallel shader compile: " << (parallelShaderCompile ? "yes" : "no") << std::endl;
+
+        if(supported("GL_ARB_bindless_texture"))
+        {
+            getTextureHandle = (PFNGLGETTEXTUREHANDLEARBPROC)loader("glGetTextureHandleARB");
+            makeTextureHandleResident = (PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)loader("glMakeTextureHandleResidentARB");
+        }
+        bindlessTexture = getTextureHandle != nullptr && makeTextureHandleResident != nullptr;
+        std::cout << "Bindless textures: " << (bindlessTexture ? "yes" : "no") << std::endl;
+    }
+
+    static bool supported(const char *name)
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for(GLint i = 0; i < count; i++)
+        {
+            const char *extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if(extension != nullptr && strcmp(extension, name) == 0)
+                return true;
+        }
+        return false;
+    }
+};
+
+bool GLExtensions::parallelShaderCompile = false;
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC GLExtensions::maxShaderCompilerThreads = nullptr;
+bool GLExtensions::bindlessTexture = false;
+PFNGLGETTEXTUREHANDLEARBPROC GLExtensions::getTextureHandle = nullptr;
+PFNGLMAKETEXTUREHANDLERESIDENTARBPROC GLExtensions::makeTextureHandleResident = nullptr;
+
+#endif
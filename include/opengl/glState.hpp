@@ -0,0 +1,419 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// number of texture units and indexed buffer bindings that are shadowed,
+// bindings beyond these are passed through to GL
+#define GLSTATE_TEXTURE_UNITS 32
+#define GLSTATE_BUFFER_BINDINGS 16
+#define GLSTATE_UNKNOWN 0xFFFFFFFFu
+
+// shadows the bound program, vertex array, buffers, textures, framebuffers and the
+// blend/depth/stencil state of the context, and drops calls that would not change it.
+// every class in include/opengl goes through it, code that changes state behind its
+// back has to call invalidate() afterwards. objects are deleted through it as well,
+// so a recycled name is never mistaken for a binding that is still current.
+class GLState
+{
+public:
+    // calls issued to GL and calls dropped as redundant since the last beginFrame()
+    unsigned long issuedCalls = 0;
+    unsigned long skippedCalls = 0;
+    // totals of the last completed frame
+    unsigned long lastFrameIssued = 0;
+    unsigned long lastFrameSkipped = 0;
+    // glBindTexture calls that reached GL, part of issuedCalls
+    unsigned long textureBinds = 0;
+    unsigned long lastFrameTextureBinds = 0;
+
+    static GLState &instance()
+    {
+        static GLState state;
+        return state;
+    }
+
+    void beginFrame()
+    {
+        lastFrameIssued = issuedCalls;
+        lastFrameSkipped = skippedCalls;
+        lastFrameTextureBinds = textureBinds;
+        issuedCalls = 0;
+        skippedCalls = 0;
+        textureBinds = 0;
+    }
+
+    // forget everything, the next call of each kind reaches GL
+    void invalidate()
+    {
+        program = vertexArray = drawFramebuffer = readFramebuffer = activeUnit = GLSTATE_UNKNOWN;
+        memset(buffers, 0xFF, sizeof(buffers));
+        memset(indexedBuffers, 0xFF, sizeof(indexedBuffers));
+        memset(indexedRanges, 0xFF, sizeof(indexedRanges));
+        memset(textures, 0xFF, sizeof(textures));
+        memset(capabilities, 0xFF, sizeof(capabilities));
+        blendSrc = blendDst = depthFunction = GLSTATE_UNKNOWN;
+        depthWrite = GLSTATE_UNKNOWN;
+        stencilFunction = stencilRef = stencilReadMask = GLSTATE_UNKNOWN;
+        stencilFail = stencilDepthFail = stencilPass = stencilWriteMask = GLSTATE_UNKNOWN;
+        memset(viewportRect, 0xFF, sizeof(viewportRect));
+    }
+
+    // bindings
+    // ------------------------------------------------------------------------
+    void useProgram(GLuint id)
+    {
+        if(!change(program, id))
+            return;
+        glUseProgram(id);
+    }
+
+    void bindVertexArray(GLuint id)
+    {
+        if(!change(vertexArray, id))
+            return;
+        glBindVertexArray(id);
+    }
+
+    // GL_ELEMENT_ARRAY_BUFFER belongs to the bound vertex array and is never skipped
+    void bindBuffer(GLenum target, GLuint buffer)
+    {
+        int slot = bufferSlot(target);
+        if(slot < 0)
+        {
+            issuedCalls++;
+            glBindBuffer(target, buffer);
+            return;
+        }
+        if(!change(buffers[slot], buffer))
+            return;
+        glBindBuffer(target, buffer);
+    }
+
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+    {
+        // the whole buffer is recorded as the range [0, 0)
+        if(!changeIndexed(target, index, buffer, 0, 0))
+            return;
+        glBindBufferBase(target, index, buffer);
+    }
+
+    void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        if(!changeIndexed(target, index, buffer, offset, size))
+            return;
+        glBindBufferRange(target, index, buffer, offset, size);
+    }
+
+    void bindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        int slot = textureSlot(target);
+        if(slot < 0 || unit >= GLSTATE_TEXTURE_UNITS)
+        {
+            activeTexture(unit);
+            issuedCalls++;
+            textureBinds++;
+            glBindTexture(target, texture);
+            return;
+        }
+        if(textures[unit][slot] == texture)
+        {
+            skippedCalls++;
+            return;
+        }
+        activeTexture(unit);
+        issuedCalls++;
+        textureBinds++;
+        textures[unit][slot] = texture;
+        glBindTexture(target, texture);
+    }
+
+    void bindFramebuffer(GLenum target, GLuint framebuffer)
+    {
+        bool draw = target != GL_READ_FRAMEBUFFER;
+        bool read = target != GL_DRAW_FRAMEBUFFER;
+        if((!draw || drawFramebuffer == framebuffer) && (!read || readFramebuffer == framebuffer))
+        {
+            skippedCalls++;
+            return;
+        }
+        issuedCalls++;
+        if(draw)
+            drawFramebuffer = framebuffer;
+        if(read)
+            readFramebuffer = framebuffer;
+        glBindFramebuffer(target, framebuffer);
+    }
+
+    // fixed function state
+    // ------------------------------------------------------------------------
+    void setEnabled(GLenum capability, bool enabled)
+    {
+        int slot = capabilitySlot(capability);
+        if(slot < 0)
+        {
+            issuedCalls++;
+            enabled ? glEnable(capability) : glDisable(capability);
+            return;
+        }
+        if(!change(capabilities[slot], enabled ? 1u : 0u))
+            return;
+        enabled ? glEnable(capability) : glDisable(capability);
+    }
+
+    void blendFunc(GLenum src, GLenum dst)
+    {
+        if(blendSrc == src && blendDst == dst)
+        {
+            skippedCalls++;
+            return;
+        }
+        issuedCalls++;
+        blendSrc = src;
+        blendDst = dst;
+        glBlendFunc(src, dst);
+    }
+
+    void depthFunc(GLenum func)
+    {
+        if(!change(depthFunction, func))
+            return;
+        glDepthFunc(func);
+    }
+
+    void depthMask(bool write)
+    {
+        if(!change(depthWrite, write ? 1u : 0u))
+            return;
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+
+    void stencilFunc(GLenum func, GLint ref, GLuint mask)
+    {
+        if(stencilFunction == func && stencilRef == static_cast<GLuint>(ref) && stencilReadMask == mask)
+        {
+            skippedCalls++;
+            return;
+        }
+        issuedCalls++;
+        stencilFunction = func;
+        stencilRef = static_cast<GLuint>(ref);
+        stencilReadMask = mask;
+        glStencilFunc(func, ref, mask);
+    }
+
+    void stencilOp(GLenum fail, GLenum depthFail, GLenum pass)
+    {
+        if(stencilFail == fail && stencilDepthFail == depthFail && stencilPass == pass)
+        {
+            skippedCalls++;
+            return;
+        }
+        issuedCalls++;
+        stencilFail = fail;
+        stencilDepthFail = depthFail;
+        stencilPass = pass;
+        glStencilOp(fail, depthFail, pass);
+    }
+
+    void stencilMask(GLuint mask)
+    {
+        if(!change(stencilWriteMask, mask))
+            return;
+        glStencilMask(mask);
+    }
+
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+    {
+        GLint rect[4] = {x, y, width, height};
+        if(memcmp(rect, viewportRect, sizeof(rect)) == 0)
+        {
+            skippedCalls++;
+            return;
+        }
+        issuedCalls++;
+        memcpy(viewportRect, rect, sizeof(rect));
+        glViewport(x, y, width, height);
+    }
+
+    // the current viewport, asked from GL once if nothing set it through the cache yet
+    void getViewport(GLint rect[4])
+    {
+        if(viewportRect[0] == static_cast<GLint>(GLSTATE_UNKNOWN))
+            glGetIntegerv(GL_VIEWPORT, viewportRect);
+        memcpy(rect, viewportRect, sizeof(viewportRect));
+    }
+
+    // deletion
+    // ------------------------------------------------------------------------
+    void deleteBuffer(GLuint buffer)
+    {
+        for(GLuint &binding : buffers)
+            if(binding == buffer)
+                binding = 0;
+        for(auto &bindings : indexedBuffers)
+            for(GLuint &binding : bindings)
+                if(binding == buffer)
+                    binding = 0;
+        glDeleteBuffers(1, &buffer);
+    }
+
+    void deleteTexture(GLuint texture)
+    {
+        for(auto &unit : textures)
+            for(GLuint &binding : unit)
+                if(binding == texture)
+                    binding = 0;
+        glDeleteTextures(1, &texture);
+    }
+
+    // a program in use is only deleted by GL once unbound, so it is unbound first
+    void deleteProgram(GLuint id)
+    {
+        if(program == id)
+        {
+            issuedCalls++;
+            program = 0;
+            glUseProgram(0);
+        }
+        glDeleteProgram(id);
+    }
+
+    // deleting a bound vertex array or framebuffer binds 0 in its place
+    void deleteVertexArray(GLuint id)
+    {
+        if(vertexArray == id)
+            vertexArray = 0;
+        glDeleteVertexArrays(1, &id);
+    }
+
+    void deleteFramebuffer(GLuint framebuffer)
+    {
+        if(drawFramebuffer == framebuffer)
+            drawFramebuffer = 0;
+        if(readFramebuffer == framebuffer)
+            readFramebuffer = 0;
+        glDeleteFramebuffers(1, &framebuffer);
+    }
+
+private:
+    static const int BUFFER_TARGETS = 7;
+    static const int TEXTURE_TARGETS = 3;
+    static const int CAPABILITIES = 6;
+
+    GLuint program, vertexArray, drawFramebuffer, readFramebuffer, activeUnit;
+    GLuint buffers[BUFFER_TARGETS];
+    GLuint indexedBuffers[2][GLSTATE_BUFFER_BINDINGS];
+    // offset and size of each indexed binding
+    GLintptr indexedRanges[2][GLSTATE_BUFFER_BINDINGS][2];
+    GLuint textures[GLSTATE_TEXTURE_UNITS][TEXTURE_TARGETS];
+    GLuint capabilities[CAPABILITIES];
+    GLuint blendSrc, blendDst, depthFunction, depthWrite;
+    GLuint stencilFunction, stencilRef, stencilReadMask;
+    GLuint stencilFail, stencilDepthFail, stencilPass, stencilWriteMask;
+    GLint viewportRect[4];
+
+    GLState()
+    {
+        invalidate();
+    }
+
+    // records the new value, false (and counted as skipped) if it is already set
+    bool change(GLuint &current, GLuint value)
+    {
+        if(current == value)
+        {
+            skippedCalls++;
+            return false;
+        }
+        issuedCalls++;
+        current = value;
+        return true;
+    }
+
+    // records an indexed binding, which changes the generic binding point as well.
+    // false (and counted as skipped) if both are already set.
+    bool changeIndexed(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        int slot = indexedSlot(target);
+        if(slot < 0 || index >= GLSTATE_BUFFER_BINDINGS)
+        {
+            issuedCalls++;
+            return true;
+        }
+        int generic = bufferSlot(target);
+        GLintptr *range = indexedRanges[slot][index];
+        if(indexedBuffers[slot][index] == buffer && range[0] == offset && range[1] == size && buffers[generic] == buffer)
+        {
+            skippedCalls++;
+            return false;
+        }
+        issuedCalls++;
+        indexedBuffers[slot][index] = buffer;
+        range[0] = offset;
+        range[1] = size;
+        buffers[generic] = buffer;
+        return true;
+    }
+
+    void activeTexture(GLuint unit)
+    {
+        if(!change(activeUnit, unit))
+            return;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    static int bufferSlot(GLenum target)
+    {
+        switch(target)
+        {
+            case GL_ARRAY_BUFFER: return 0;
+            case GL_COPY_READ_BUFFER: return 1;
+            case GL_COPY_WRITE_BUFFER: return 2;
+            case GL_DRAW_INDIRECT_BUFFER: return 3;
+            case GL_SHADER_STORAGE_BUFFER: return 4;
+            case GL_UNIFORM_BUFFER: return 5;
+            case GL_PIXEL_UNPACK_BUFFER: return 6;
+            default: return -1;
+        }
+    }
+
+    static int indexedSlot(GLenum target)
+    {
+        switch(target)
+        {
+            case GL_SHADER_STORAGE_BUFFER: return 0;
+            case GL_UNIFORM_BUFFER: return 1;
+            default: return -1;
+        }
+    }
+
+    static int textureSlot(GLenum target)
+    {
+        switch(target)
+        {
+            case GL_TEXTURE_2D: return 0;
+            case GL_TEXTURE_CUBE_MAP: return 1;
+            case GL_TEXTURE_2D_ARRAY: return 2;
+            default: return -1;
+        }
+    }
+
+    static int capabilitySlot(GLenum capability)
+    {
+        switch(capability)
+        {
+            case GL_BLEND: return 0;
+            case GL_DEPTH_TEST: return 1;
+            case GL_STENCIL_TEST: return 2;
+            case GL_CULL_FACE: return 3;
+            case GL_TEXTURE_CUBE_MAP_SEAMLESS: return 4;
+            case GL_POLYGON_OFFSET_FILL: return 5;
+            default: return -1;
+        }
+    }
+};
+
+#endif
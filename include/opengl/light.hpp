@@ -7,8 +7,36 @@
 #include <vector>
 
 #include <opengl/shader.hpp>
+#include <opengl/ringBuffer.hpp>
+#include <opengl/lightClusters.hpp>
+#include <opengl/model.hpp>
 
-#define MAX_LIGHTS 10
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// of each kind. light_cluster.cs keeps shading cost per fragment bounded by the lights
+// that reach it, the count only bounds the light buffers
+#define MAX_LIGHTS 4096
+#define LIGHT_INITIAL_CAPACITY 16
+// fraction of its intensity below which a light no longer contributes, gives its range
+#define LIGHT_CUTOFF 0.005f
+// shader storage binding of the per-object light lists, see lightObjects.glsl
+#define LIGHT_OBJECT_BINDING 13
+// lights an object's list holds, the ones found after are dropped
+#define LIGHT_OBJECT_MAX_LIGHTS 32
+#define LIGHT_OBJECT_STRIDE (1 + LIGHT_OBJECT_MAX_LIGHTS)
+#define LIGHT_OBJECT_SPOT_BIT 0x80000000u
+#define LIGHT_OBJECT_UNASSIGNED 0xFFFFFFFFu
+#define LIGHT_NO_SLOT 0xFFFFFFFFu
+// flags of a light record: the light is baked into static models
+#define LIGHT_FLAG_STATIC 1u
+// shader storage bindings of the per-vertex baked lighting and of the table locating each
+// object's colors in it, see bakedLight.glsl
+#define LIGHT_BAKED_BINDING 14
+#define LIGHT_BAKED_OBJECT_BINDING 15
 #define PI 3.14159265359
 
 struct DirectionalLight {
@@ -17,19 +45,43 @@ struct DirectionalLight {
     float intensity;
 };
 
+// the records are packed as light.glsl reads them, with what it would otherwise compute
+// per fragment worked out once
 struct alignas(16) PointLight {
+    // w: range, the distance at which the light is cut off
     glm::vec4 position;
+    // color times intensity, w: 1 / range
     glm::vec4 color;
-    float intensity;
+    // LIGHT_FLAG_*
+    uint32_t flags;
+    float padding[3];
 };
 
 struct alignas(16) SpotLight {
+    // w: range, the distance at which the light is cut off
     glm::vec4 position;
-    glm::vec4 direction;
+    // color times intensity, w: 1 / range
     glm::vec4 color;
-    float intensity;
-    float cutOff;
-    float outerCutOff;
+    // w: cosine of the outer cut-off
+    glm::vec4 direction;
+    // cosine of the inner cut-off
+    float cosCutOff;
+    // 1 / (cosCutOff - cosine of the outer cut-off)
+    float invCutOffRange;
+    // record in the ShadowAtlas, -1 without a shadow map
+    int shadow;
+    // LIGHT_FLAG_*
+    uint32_t flags;
+};
+
+// names a light while other lights are added and removed, which moves lights around in
+// the buffers. the handle of a removed light must not be used again.
+struct LightHandle
+{
+    uint32_t slot = LIGHT_NO_SLOT;
+    bool spot = false;
+
+    bool valid() const { return slot != LIGHT_NO_SLOT; }
 };
 
 class LightManager
@@ -46,19 +98,26 @@ public:
         directionalLight.intensity = 0.4f;
 
         // init buffers
-        glGenBuffers(1, &pointLightBuffer);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointLightBuffer);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_LIGHTS * sizeof(PointLight), NULL, GL_STATIC_DRAW);
-
-        glGenBuffers(1, &spotLightBuffer);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, spotLightBuffer);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_LIGHTS * sizeof(SpotLight), NULL, GL_STATIC_DRAW);
+        pointLightBuffer.reserve(LIGHT_INITIAL_CAPACITY * sizeof(PointLight));
+        spotLightBuffer.reserve(LIGHT_INITIAL_CAPACITY * sizeof(SpotLight));
+        objectLightBuffer.reserve(LIGHT_INITIAL_CAPACITY * sizeof(uint32_t));
     }
     
     void clearLights()
     {
         pointLights.clear();
         spotLights.clear();
+        pointSlots.clear();
+        spotSlots.clear();
+        lightVersion++;
+        definesVersion++;
+    }
+
+    // directional ambient: 9 SH coefficients of the sky's irradiance, as SkyBox projects
+    // them. the ambient light scales it.
+    void setAmbientIrradiance(const glm::vec3 (&coefficients)[9])
+    {
+        std::copy(coefficients, coefficients + 9, ambientIrradiance);
     }
 
     void setDirectionalLight(glm::vec3 direction, glm::vec3 color, float intensity)
@@ -68,85 +127,435 @@ public:
         directionalLight.intensity = intensity;
     }
 
-    void addPointLight(glm::vec3 position, glm::vec3 color, float intensity)
+    // lights can be added, edited and removed any number of times in a frame: every edit
+    // only marks its records, Attach copies them once per frame. an invalid handle is
+    // returned when MAX_LIGHTS is reached.
+    LightHandle addPointLight(glm::vec3 position, glm::vec3 color, float intensity)
     {
-        if(spotLights.size() >= MAX_LIGHTS)
+        if(pointLights.size() >= MAX_LIGHTS)
         {
-            return;
+            return LightHandle();
         }
-        PointLight pointLight;
-        pointLight.position = glm::vec4(position, 1.0);
-        pointLight.color = glm::vec4(color, 1.0);
-        pointLight.intensity = intensity;
+        PointLight pointLight = {};
+        pointLight.position = glm::vec4(position, 0.0f);
         pointLights.push_back(pointLight);
-        updateBuffers();
+        setColor(pointLights.back().position, pointLights.back().color, color, intensity);
+        invalidateLight(pointLightBuffer, pointLights.size() - 1, sizeof(PointLight));
+        definesVersion++;
+        return {pointSlots.add(static_cast<uint32_t>(pointLights.size() - 1)), false};
     }
 
-    void removePointLight(int index)
+    // angles in degrees, measured from the direction to the cone's edge
+    LightHandle addSpotLight(glm::vec3 position, glm::vec3 direction, glm::vec3 color, float intensity, float cutOff, float outerCutOff)
     {
-        if(index < pointLights.size())
+        if(spotLights.size() >= MAX_LIGHTS)
         {
-            pointLights.erase(pointLights.begin() + index);
-            updateBuffers();
+            return LightHandle();
         }
+        SpotLight spotLight;
+        spotLight.position = glm::vec4(position, 0.0f);
+        spotLight.direction = glm::vec4(normalize(direction), 0.0f);
+        spotLight.color = glm::vec4(0.0f);
+        spotLight.shadow = -1;
+        spotLight.flags = 0;
+        spotLights.push_back(spotLight);
+        setColor(spotLights.back().position, spotLights.back().color, color, intensity);
+        setCutOff(spotLights.back(), cutOff, outerCutOff);
+        invalidateLight(spotLightBuffer, spotLights.size() - 1, sizeof(SpotLight));
+        definesVersion++;
+        return {spotSlots.add(static_cast<uint32_t>(spotLights.size() - 1)), true};
     }
 
-    void addSpotLight(glm::vec3 position, glm::vec3 direction, glm::vec3 color, float intensity, float cutOff, float outerCutOff)
+    // the last light of the kind takes the removed one's place, so only two records change
+    void removeLight(LightHandle light)
     {
-        if(spotLights.size() >= MAX_LIGHTS)
-        {
+        uint32_t index = find(light);
+        if(index == LIGHT_NO_SLOT)
+            return;
+        if(light.spot)
+            removeRecord(spotLights, spotSlots, spotLightBuffer, light.slot, index);
+        else
+            removeRecord(pointLights, pointSlots, pointLightBuffer, light.slot, index);
+    }
+
+    void setLightPosition(LightHandle light, glm::vec3 position)
+    {
+        uint32_t index = find(light);
+        if(index == LIGHT_NO_SLOT)
+            return;
+        glm::vec4 &record = light.spot ? spotLights[index].position : pointLights[index].position;
+        record = glm::vec4(position, record.w);
+        invalidate(light, index);
+    }
+
+    void setLightColor(LightHandle light, glm::vec3 color, float intensity)
+    {
+        uint32_t index = find(light);
+        if(index == LIGHT_NO_SLOT)
+            return;
+        if(light.spot)
+            setColor(spotLights[index].position, spotLights[index].color, color, intensity);
+        else
+            setColor(pointLights[index].position, pointLights[index].color, color, intensity);
+        invalidate(light, index);
+    }
+
+    void setSpotLightDirection(LightHandle light, glm::vec3 direction)
+    {
+        uint32_t index = light.spot ? find(light) : LIGHT_NO_SLOT;
+        if(index == LIGHT_NO_SLOT)
             return;
+        spotLights[index].direction = glm::vec4(normalize(direction), spotLights[index].direction.w);
+        invalidate(light, index);
+    }
+
+    void setSpotLightCutOff(LightHandle light, float cutOff, float outerCutOff)
+    {
+        uint32_t index = light.spot ? find(light) : LIGHT_NO_SLOT;
+        if(index == LIGHT_NO_SLOT)
+            return;
+        setCutOff(spotLights[index], cutOff, outerCutOff);
+        invalidate(light, index);
+    }
+
+    // ambient, directional light and light counts reach the shaders through FrameConstants
+    const glm::vec3 &getAmbientLight() const { return ambientLight; }
+    const glm::vec3 (&getAmbientIrradiance() const)[9] { return ambientIrradiance; }
+    const DirectionalLight &getDirectionalLight() const { return directionalLight; }
+    unsigned int getPointLightCount() const { return static_cast<unsigned int>(pointLights.size()); }
+    unsigned int getSpotLightCount() const { return static_cast<unsigned int>(spotLights.size()); }
+    const PointLight &getPointLight(unsigned int index) const { return pointLights[index]; }
+    const SpotLight &getSpotLight(unsigned int index) const { return spotLights[index]; }
+
+    // static lights are baked into static models by the LightBaker, which then skip them
+    // at runtime. lights are dynamic when added.
+    void setLightStatic(LightHandle light, bool isStatic)
+    {
+        uint32_t index = find(light);
+        if(index == LIGHT_NO_SLOT)
+            return;
+        uint32_t &flags = light.spot ? spotLights[index].flags : pointLights[index].flags;
+        flags = isStatic ? flags | LIGHT_FLAG_STATIC : flags & ~LIGHT_FLAG_STATIC;
+        invalidate(light, index);
+    }
+
+    // assigned by the ShadowAtlas every frame, before Attach
+    void setSpotLightShadow(unsigned int index, int record)
+    {
+        if(spotLights[index].shadow == record)
+            return;
+        spotLights[index].shadow = record;
+        size_t offset = index * sizeof(SpotLight) + offsetof(SpotLight, shadow);
+        spotLightBuffer.invalidate(offset, offset + sizeof(int));
+    }
+
+    // shadows of the directional and spot lights are sampled from the ShadowAtlas, which
+    // the render loop has to update. decide before building programs.
+    void enableShadows(bool enable)
+    {
+        shadowed = enable;
+        definesVersion++;
+    }
+
+    bool usesShadows() const
+    {
+        return shadowed;
+    }
+
+    // programs read the LightBaker's per-vertex lighting, which replaces the ambient, the
+    // directional and the static lights of baked vertices. decide before building programs.
+    void enableBakedLighting(bool enable)
+    {
+        baked = enable;
+        definesVersion++;
+    }
+
+    bool usesBakedLighting() const
+    {
+        return baked;
+    }
+
+    // clustered shading is on by default. without it every fragment loops over the
+    // lights of its object's list, or over all lights, which is cheaper for a handful of
+    // them. decide before building programs.
+    void enableClusters(bool enable)
+    {
+        clustered = enable;
+        definesVersion++;
+    }
+
+    bool usesClusters() const
+    {
+        return clustered;
+    }
+
+    void enableObjectLists(bool enable)
+    {
+        objectLists = enable;
+        definesVersion++;
+    }
+
+    bool usesObjectLists() const
+    {
+        return !clustered && objectLists;
+    }
+
+    // lists the point and spot lights whose range reaches the model's bounds, for the
+    // draws of its object. the list is only rebuilt after the model or a light changed.
+    // call every frame for the models the lit passes draw, before Attach.
+    void assignLights(Model &model)
+    {
+        if(!usesObjectLists())
+            return;
+        glm::vec3 center;
+        float radius;
+        model.getBounds(center, radius);
+        unsigned int object = model.getObjectIndex();
+        if(object >= objectStates.size())
+        {
+            size_t first = objectLights.size();
+            objectStates.resize(object + 1);
+            objectLights.resize(objectStates.size() * LIGHT_OBJECT_STRIDE, 0u);
+            // objects in between are unassigned and shade every light
+            for(size_t i = first; i < objectLights.size(); i += LIGHT_OBJECT_STRIDE)
+                objectLights[i] = LIGHT_OBJECT_UNASSIGNED;
+            objectLightBuffer.invalidate(first * sizeof(uint32_t), objectLights.size() * sizeof(uint32_t));
         }
-        SpotLight spotLight;
-        spotLight.position = glm::vec4(position, 1.0);
-        spotLight.direction = glm::vec4(normalize(direction), 1.0);
-        spotLight.color = glm::vec4(color, 1.0);
-        spotLight.intensity = intensity;
-        spotLight.cutOff = clamp(cutOff / 180.0f, 0.0f, 1.0f) * PI;
-        spotLight.outerCutOff = clamp(outerCutOff / 180.0f , 0.0f, 1.0f) * PI;
-        spotLights.push_back(spotLight);
-        updateBuffers();
+        ObjectLightState &state = objectStates[object];
+        if(state.version == lightVersion && state.center == center && state.radius == radius)
+            return;
+        state = {center, radius, lightVersion};
+
+        uint32_t *list = objectLights.data() + object * LIGHT_OBJECT_STRIDE;
+        uint32_t count = 0;
+        for(uint32_t i = 0; i < pointLights.size() && count < LIGHT_OBJECT_MAX_LIGHTS; i++)
+            if(reaches(pointLights[i].position, center, radius))
+                list[1 + count++] = i;
+        for(uint32_t i = 0; i < spotLights.size() && count < LIGHT_OBJECT_MAX_LIGHTS; i++)
+            if(reaches(spotLights[i].position, center, radius))
+                list[1 + count++] = i | LIGHT_OBJECT_SPOT_BIT;
+        list[0] = count;
+        size_t offset = object * LIGHT_OBJECT_STRIDE * sizeof(uint32_t);
+        objectLightBuffer.invalidate(offset, offset + (1 + count) * sizeof(uint32_t));
+    }
+
+    // bumped by every change that may change getShaderDefines: light counts and the
+    // enable* switches. programs built with the defines compare it to reselect theirs.
+    unsigned long getDefinesVersion() const
+    {
+        return definesVersion;
     }
 
-    void removeSpotLight(int index)
+    // defines specializing light.glsl: the cluster grid or the current light counts, shadows
+    ShaderDefines getShaderDefines() const
     {
-        if(index < spotLights.size())
+        ShaderDefines defines;
+        if(clustered)
         {
-            spotLights.erase(spotLights.begin() + index);
-            updateBuffers();
+            defines = LightClusters::getShaderDefines();
         }
+        else
+        {
+            defines["LIGHT_POINT_COUNT"] = std::to_string(pointLights.size());
+            defines["LIGHT_SPOT_COUNT"] = std::to_string(spotLights.size());
+        }
+        if(usesObjectLists())
+        {
+            defines["LIGHT_OBJECT_LISTS"] = "1";
+            defines["LIGHT_OBJECT_MAX_LIGHTS"] = std::to_string(LIGHT_OBJECT_MAX_LIGHTS);
+        }
+        if(shadowed)
+            defines["LIGHT_SHADOWS"] = "1";
+        if(baked)
+            defines["LIGHT_BAKED"] = "1";
+        return defines;
     }
 
-    void Attach(Shader &shader)
+    // bins the lights for the camera and views - 1 mirrors, after Attach and with the
+    // frame constants and reflect planes bound. does nothing without clusters.
+    void buildClusters(unsigned int views)
     {
-        // set uniforms
-        shader.setVec3("GL_AmbientLight", ambientLight);
-        shader.setUint("GL_Num_PointLight", pointLights.size());
-        shader.setUint("GL_Num_SpotLight", spotLights.size());
-        shader.setVec3("GL_DirectionalLight.direction", directionalLight.direction);
-        shader.setVec3("GL_DirectionalLight.color", directionalLight.color);
-        shader.setFloat("GL_DirectionalLight.intensity", directionalLight.intensity);
+        if(!clustered)
+            return;
+        // the culling program is created on first use
+        if(!clusters)
+            clusters.reset(new LightClusters());
+        clusters->build(views);
+    }
 
-        // bind buffers
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, pointLightBuffer);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, spotLightBuffer);
+    // copies the lights changed since this frame's region was last written, then binds it
+    void Attach()
+    {
+        reserveBuffers();
+        pointLightBuffer.update(pointLights.data(), pointLights.size() * sizeof(PointLight));
+        spotLightBuffer.update(spotLights.data(), spotLights.size() * sizeof(SpotLight));
+        pointLightBuffer.bindBase(0);
+        spotLightBuffer.bindBase(1);
+        if(usesObjectLists())
+        {
+            objectLightBuffer.update(objectLights.data(), objectLights.size() * sizeof(uint32_t));
+            objectLightBuffer.bindBase(LIGHT_OBJECT_BINDING);
+        }
     }
 
 private:
     DirectionalLight directionalLight;
     glm::vec3 ambientLight;
+    // a uniformly white sky until one is set
+    glm::vec3 ambientIrradiance[9] = {glm::vec3(1.0f)};
     std::vector<PointLight> pointLights;
     std::vector<SpotLight> spotLights;
 
-    GLuint pointLightBuffer, spotLightBuffer;
+    // maps the slots of handles to the current indices of their lights
+    struct LightSlots
+    {
+        std::vector<uint32_t> indices;
+        std::vector<uint32_t> slots;
+        std::vector<uint32_t> freeSlots;
+
+        uint32_t add(uint32_t index)
+        {
+            uint32_t slot;
+            if(freeSlots.empty())
+            {
+                slot = static_cast<uint32_t>(indices.size());
+                indices.push_back(index);
+            }
+            else
+            {
+                slot = freeSlots.back();
+                freeSlots.pop_back();
+                indices[slot] = index;
+            }
+            slots.push_back(slot);
+            return slot;
+        }
+
+        uint32_t find(uint32_t slot) const
+        {
+            return slot < indices.size() ? indices[slot] : LIGHT_NO_SLOT;
+        }
+
+        // the last light moved to index
+        void remove(uint32_t slot, uint32_t index)
+        {
+            uint32_t moved = slots.back();
+            slots[index] = moved;
+            indices[moved] = index;
+            slots.pop_back();
+            indices[slot] = LIGHT_NO_SLOT;
+            freeSlots.push_back(slot);
+        }
+
+        void clear()
+        {
+            indices.clear();
+            slots.clear();
+            freeSlots.clear();
+        }
+    };
+    LightSlots pointSlots, spotSlots;
+
+    RingBuffer pointLightBuffer = RingBuffer(GL_SHADER_STORAGE_BUFFER);
+    RingBuffer spotLightBuffer = RingBuffer(GL_SHADER_STORAGE_BUFFER);
+    bool clustered = true;
+    bool shadowed = true;
+    bool baked = false;
+    bool objectLists = true;
+    std::unique_ptr<LightClusters> clusters;
+
+    // bounds and lights an object's list was built for
+    struct ObjectLightState
+    {
+        glm::vec3 center = glm::vec3(0.0f);
+        float radius = -1.0f;
+        unsigned long version = 0;
+    };
+    // bumped by every change to the point and spot lights
+    unsigned long lightVersion = 1;
+    unsigned long definesVersion = 0;
+    std::vector<ObjectLightState> objectStates;
+    // LIGHT_OBJECT_STRIDE entries per object: the count, then the light indices
+    std::vector<uint32_t> objectLights;
+    RingBuffer objectLightBuffer = RingBuffer(GL_SHADER_STORAGE_BUFFER);
+
+    // position.w is the light's range
+    static bool reaches(const glm::vec4 &position, const glm::vec3 &center, float radius)
+    {
+        glm::vec3 offset = glm::vec3(position) - center;
+        float reach = position.w + radius;
+        return glm::dot(offset, offset) <= reach * reach;
+    }
+
+    // distance at which intensity / distance^2 of the brightest channel drops to LIGHT_CUTOFF
+    static float lightRange(glm::vec3 color, float intensity)
+    {
+        float brightest = std::max(color.r, std::max(color.g, color.b));
+        return std::sqrt(std::max(brightest * intensity, 0.0f) / LIGHT_CUTOFF);
+    }
+
+    // doubles the ring buffers when the lights outgrow them, growing rewrites every region
+    void reserveBuffers()
+    {
+        size_t pointSize = pointLights.size() * sizeof(PointLight);
+        if(pointSize > pointLightBuffer.size())
+            pointLightBuffer.reserve(std::max(pointSize, pointLightBuffer.size() * 2));
+        size_t spotSize = spotLights.size() * sizeof(SpotLight);
+        if(spotSize > spotLightBuffer.size())
+            spotLightBuffer.reserve(std::max(spotSize, spotLightBuffer.size() * 2));
+        size_t objectSize = objectLights.size() * sizeof(uint32_t);
+        if(usesObjectLists() && objectSize > objectLightBuffer.size())
+            objectLightBuffer.reserve(std::max(objectSize, objectLightBuffer.size() * 2));
+    }
+
+    static void setColor(glm::vec4 &position, glm::vec4 &record, glm::vec3 color, float intensity)
+    {
+        float range = lightRange(color, intensity);
+        position.w = range;
+        record = glm::vec4(color * intensity, range > 0.0f ? 1.0f / range : 0.0f);
+    }
+
+    static void setCutOff(SpotLight &light, float cutOff, float outerCutOff)
+    {
+        float cosCutOff = std::cos(glm::clamp(cutOff / 180.0f, 0.0f, 1.0f) * static_cast<float>(PI));
+        float cosOuterCutOff = std::cos(glm::clamp(outerCutOff / 180.0f, 0.0f, 1.0f) * static_cast<float>(PI));
+        light.cosCutOff = cosCutOff;
+        light.direction.w = cosOuterCutOff;
+        // a hard edge when both cones are the same
+        light.invCutOffRange = 1.0f / std::max(cosCutOff - cosOuterCutOff, 1e-4f);
+    }
 
-    void updateBuffers()
+    uint32_t find(LightHandle light) const
     {
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointLightBuffer);
-        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, pointLights.size() * sizeof(PointLight), pointLights.data());
+        return light.spot ? spotSlots.find(light.slot) : pointSlots.find(light.slot);
+    }
+
+    void invalidate(LightHandle light, uint32_t index)
+    {
+        if(light.spot)
+            invalidateLight(spotLightBuffer, index, sizeof(SpotLight));
+        else
+            invalidateLight(pointLightBuffer, index, sizeof(PointLight));
+    }
 
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, spotLightBuffer);
-        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, spotLights.size() * sizeof(SpotLight), spotLights.data());
+    // the record is copied into the ring buffers by Attach
+    void invalidateLight(RingBuffer &buffer, size_t index, size_t size)
+    {
+        lightVersion++;
+        buffer.invalidate(index * size, (index + 1) * size);
+    }
+
+    template<typename Light>
+    void removeRecord(std::vector<Light> &lights, LightSlots &slots, RingBuffer &buffer, uint32_t slot, uint32_t index)
+    {
+        lights[index] = lights.back();
+        lights.pop_back();
+        slots.remove(slot, index);
+        definesVersion++;
+        if(index < lights.size())
+            invalidateLight(buffer, index, sizeof(Light));
+        else
+            lightVersion++;
     }
 };
 
@@ -0,0 +1,405 @@
+#ifndef LIGHTBAKER_H
+#define LIGHTBAKER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <opengl/model.hpp>
+#include <opengl/light.hpp>
+#include <opengl/glState.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// triangles per BVH leaf
+#define BAKE_LEAF_TRIANGLES 4
+// vertices a worker takes at once
+#define BAKE_CHUNK_VERTICES 256
+// shadow rays start this far off the surface
+#define BAKE_RAY_OFFSET 1e-3f
+// nodes deeper than this become leaves, which bounds the traversal stack. median splits
+// halve the triangles per level, so only scenes of over 2^30 triangles reach it.
+#define BAKE_MAX_BVH_DEPTH 32
+
+// precomputes the lighting of static models per vertex: ambient, the directional light and
+// the static point and spot lights, each occluded by the static models. a BVH over their
+// triangles is built for the shadow rays, and the vertices are lit on all cores. every
+// model gets colors of its own, copies sharing a mesh are lit where each one stands.
+// bakedLight.glsl finds them through the model's object index and the vertex's place in
+// the GeometryBuffer pool. programs built with LIGHT_BAKED shade a baked vertex with one
+// fetch plus the lights that are not static.
+class LightBaker
+{
+public:
+    // what the last bake did
+    size_t bakedVertices = 0;
+    size_t occluders = 0;
+    unsigned int threadCount = 0;
+    double milliseconds = 0.0;
+
+    LightBaker()
+    {
+        // empty buffers until the first bake, so nothing reads as baked
+        glm::vec4 empty(0.0f);
+        BakedObject none = {};
+        upload(&empty, 1, &none, 1);
+    }
+
+    // bakes the models without dynamic = true, with the lights marked static in
+    // lightManager. call again after a static model or light changed.
+    void bake(LightManager &lightManager, std::vector<Model> &models)
+    {
+        auto start = std::chrono::steady_clock::now();
+        buildScene(models);
+        buildBvh();
+
+        // the vertices of every static model in world space. a model's colors are a block
+        // spanning the pool vertices of its meshes, found through its object index.
+        jobs.clear();
+        std::vector<BakedObject> objects;
+        size_t colorCount = 0;
+        for(Model &model : models)
+        {
+            if(model.dynamic || model.meshes.empty())
+                continue;
+            glm::mat4 transform = model.getModelMatrix();
+            glm::mat3 normalMatrix = glm::mat3(model.getNormalMatrix());
+            BakedObject block;
+            block.firstVertex = UINT32_MAX;
+            uint32_t endVertex = 0;
+            for(Mesh &mesh : model.meshes)
+            {
+                block.firstVertex = std::min(block.firstVertex, static_cast<uint32_t>(mesh.baseVertex));
+                endVertex = std::max(endVertex, static_cast<uint32_t>(mesh.baseVertex + mesh.vertices.size()));
+            }
+            block.firstColor = static_cast<uint32_t>(colorCount);
+            block.vertexCount = endVertex - block.firstVertex;
+            block.padding = 0;
+            for(Mesh &mesh : model.meshes)
+            {
+                size_t first = colorCount + mesh.baseVertex - block.firstVertex;
+                for(size_t v = 0; v < mesh.vertices.size(); v++)
+                {
+                    const Vertex &vertex = mesh.vertices[v];
+                    jobs.push_back({glm::vec3(transform * glm::vec4(vertex.Position, 1.0f)),
+                                    glm::normalize(normalMatrix * vertex.Normal), first + v});
+                }
+            }
+            colorCount += block.vertexCount;
+            unsigned int object = model.getObjectIndex();
+            if(objects.size() <= object)
+                objects.resize(object + 1, BakedObject());
+            objects[object] = block;
+        }
+        if(objects.empty())
+            objects.push_back(BakedObject());
+
+        // pool vertices between a model's meshes that belong to other meshes stay unbaked
+        std::vector<glm::vec4> colors(std::max(colorCount, static_cast<size_t>(1)), glm::vec4(0.0f));
+        std::atomic<size_t> next(0);
+        auto worker = [&]()
+        {
+            for(;;)
+            {
+                size_t first = next.fetch_add(BAKE_CHUNK_VERTICES);
+                if(first >= jobs.size())
+                    return;
+                size_t last = std::min(first + BAKE_CHUNK_VERTICES, jobs.size());
+                for(size_t i = first; i < last; i++)
+                    colors[jobs[i].color] = glm::vec4(lightVertex(lightManager, jobs[i].position, jobs[i].normal), 1.0f);
+            }
+        };
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> threads;
+        for(unsigned int t = 1; t < threadCount; t++)
+            threads.emplace_back(worker);
+        worker();
+        for(std::thread &thread : threads)
+            thread.join();
+
+        upload(colors.data(), colors.size(), objects.data(), objects.size());
+        bakedVertices = jobs.size();
+        occluders = triangles.size();
+        milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void bind()
+    {
+        GLState &state = GLState::instance();
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BAKED_BINDING, buffer);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BAKED_OBJECT_BINDING, objectBuffer);
+    }
+
+private:
+    struct Triangle
+    {
+        glm::vec3 v0, edge1, edge2;
+    };
+
+    struct Node
+    {
+        glm::vec3 min;
+        // leaves: first triangle, inner nodes: the second child, the first follows the node
+        uint32_t offset;
+        glm::vec3 max;
+        // triangles of a leaf, 0 for inner nodes
+        uint32_t count;
+    };
+
+    // a baked model's block of colors, as bakedLight.glsl reads it
+    struct BakedObject
+    {
+        uint32_t firstVertex = 0;
+        uint32_t firstColor = 0;
+        // 0 for objects that are not baked
+        uint32_t vertexCount = 0;
+        uint32_t padding = 0;
+    };
+
+    struct Job
+    {
+        glm::vec3 position;
+        glm::vec3 normal;
+        // in the colors
+        size_t color;
+    };
+
+    GLuint buffer = 0, objectBuffer = 0;
+    std::vector<Triangle> triangles;
+    std::vector<glm::vec3> centroids;
+    std::vector<uint32_t> order;
+    std::vector<Node> nodes;
+    std::vector<Job> jobs;
+    // longest shadow ray of the directional light
+    float sceneSize = 0.0f;
+
+    void upload(const glm::vec4 *colors, size_t count, const BakedObject *objects, size_t objectCount)
+    {
+        GLState &state = GLState::instance();
+        if(buffer != 0)
+            state.deleteBuffer(buffer);
+        if(objectBuffer != 0)
+            state.deleteBuffer(objectBuffer);
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, count * sizeof(glm::vec4), colors, 0);
+        glCreateBuffers(1, &objectBuffer);
+        glNamedBufferStorage(objectBuffer, objectCount * sizeof(BakedObject), objects, 0);
+        bind();
+    }
+
+    // the full level of every static mesh in world space
+    void buildScene(std::vector<Model> &models)
+    {
+        triangles.clear();
+        centroids.clear();
+        glm::vec3 sceneMin(INFINITY), sceneMax(-INFINITY);
+        for(Model &model : models)
+        {
+            if(model.dynamic)
+                continue;
+            glm::mat4 transform = model.getModelMatrix();
+            for(Mesh &mesh : model.meshes)
+            {
+                for(size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+                {
+                    glm::vec3 p[3];
+                    for(int k = 0; k < 3; k++)
+                    {
+                        p[k] = glm::vec3(transform * glm::vec4(mesh.vertices[mesh.indices[i + k]].Position, 1.0f));
+                        sceneMin = glm::min(sceneMin, p[k]);
+                        sceneMax = glm::max(sceneMax, p[k]);
+                    }
+                    triangles.push_back({p[0], p[1] - p[0], p[2] - p[0]});
+                    centroids.push_back((p[0] + p[1] + p[2]) / 3.0f);
+                }
+            }
+        }
+        sceneSize = triangles.empty() ? 0.0f : glm::length(sceneMax - sceneMin) * 2.0f;
+    }
+
+    // median splits along the widest axis of the centroids
+    void buildBvh()
+    {
+        nodes.clear();
+        order.resize(triangles.size());
+        for(uint32_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        if(!triangles.empty())
+            buildNode(0, static_cast<uint32_t>(order.size()), 0);
+        // leaves index the triangles directly
+        std::vector<Triangle> sorted(triangles.size());
+        for(size_t i = 0; i < order.size(); i++)
+            sorted[i] = triangles[order[i]];
+        triangles.swap(sorted);
+    }
+
+    void buildNode(uint32_t first, uint32_t count, int depth)
+    {
+        uint32_t index = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(Node());
+        glm::vec3 boundsMin(INFINITY), boundsMax(-INFINITY), centerMin(INFINITY), centerMax(-INFINITY);
+        for(uint32_t i = first; i < first + count; i++)
+        {
+            const Triangle &t = triangles[order[i]];
+            for(const glm::vec3 &p : {t.v0, t.v0 + t.edge1, t.v0 + t.edge2})
+            {
+                boundsMin = glm::min(boundsMin, p);
+                boundsMax = glm::max(boundsMax, p);
+            }
+            centerMin = glm::min(centerMin, centroids[order[i]]);
+            centerMax = glm::max(centerMax, centroids[order[i]]);
+        }
+        nodes[index].min = boundsMin;
+        nodes[index].max = boundsMax;
+        glm::vec3 extent = centerMax - centerMin;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        if(count <= BAKE_LEAF_TRIANGLES || extent[axis] <= 0.0f || depth >= BAKE_MAX_BVH_DEPTH)
+        {
+            nodes[index].offset = first;
+            nodes[index].count = count;
+            return;
+        }
+        uint32_t middle = first + count / 2;
+        std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count,
+                         [this, axis](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+        buildNode(first, middle - first, depth + 1);
+        nodes[index].offset = static_cast<uint32_t>(nodes.size());
+        nodes[index].count = 0;
+        buildNode(middle, first + count - middle, depth + 1);
+    }
+
+    static bool hitBox(const Node &node, const glm::vec3 &origin, const glm::vec3 &invDirection, float tMax)
+    {
+        glm::vec3 t0 = (node.min - origin) * invDirection;
+        glm::vec3 t1 = (node.max - origin) * invDirection;
+        glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+        return enter <= exit;
+    }
+
+    // Moller-Trumbore, true for a hit in (0, tMax)
+    static bool hitTriangle(const Triangle &t, const glm::vec3 &origin, const glm::vec3 &direction, float tMax)
+    {
+        glm::vec3 p = glm::cross(direction, t.edge2);
+        float det = glm::dot(t.edge1, p);
+        if(std::abs(det) < 1e-12f)
+            return false;
+        float invDet = 1.0f / det;
+        glm::vec3 s = origin - t.v0;
+        float u = glm::dot(s, p) * invDet;
+        if(u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, t.edge1);
+        float v = glm::dot(direction, q) * invDet;
+        if(v < 0.0f || u + v > 1.0f)
+            return false;
+        float distance = glm::dot(t.edge2, q) * invDet;
+        return distance > 0.0f && distance < tMax;
+    }
+
+    // any hit along the ray, direction normalized
+    bool occluded(const glm::vec3 &origin, const glm::vec3 &direction, float tMax) const
+    {
+        if(nodes.empty())
+            return false;
+        glm::vec3 invDirection = 1.0f / direction;
+        // one pending sibling per level below the root, plus the node being expanded
+        uint32_t stack[BAKE_MAX_BVH_DEPTH + 1];
+        int size = 0;
+        stack[size++] = 0;
+        while(size > 0)
+        {
+            const Node &node = nodes[stack[--size]];
+            if(!hitBox(node, origin, invDirection, tMax))
+                continue;
+            if(node.count > 0)
+            {
+                for(uint32_t i = node.offset; i < node.offset + node.count; i++)
+                    if(hitTriangle(triangles[i], origin, direction, tMax))
+                        return true;
+            }
+            else
+            {
+                stack[size++] = node.offset;
+                stack[size++] = static_cast<uint32_t>(&node - nodes.data()) + 1;
+            }
+        }
+        return false;
+    }
+
+    // same terms as light.glsl, without the view dependent specular
+    static float diffuse(const glm::vec3 &lightDir, const glm::vec3 &normal)
+    {
+        return std::max(glm::dot(lightDir, normal) + 0.1f, 0.0f);
+    }
+
+    static float window(float x)
+    {
+        float w = glm::clamp(1.0f - x * x * x * x, 0.0f, 1.0f);
+        return w * w;
+    }
+
+    static glm::vec3 irradiance(const glm::vec3 (&sh)[9], const glm::vec3 &n)
+    {
+        glm::vec3 result = sh[0] + sh[1] * n.y + sh[2] * n.z + sh[3] * n.x
+            + sh[4] * (n.x * n.y) + sh[5] * (n.y * n.z) + sh[6] * (3.0f * n.z * n.z - 1.0f)
+            + sh[7] * (n.x * n.z) + sh[8] * (n.x * n.x - n.y * n.y);
+        return glm::max(result, glm::vec3(0.0f));
+    }
+
+    // the light reaching a point to be multiplied by its diffuse color
+    glm::vec3 lightVertex(LightManager &lightManager, const glm::vec3 &position, const glm::vec3 &normal) const
+    {
+        glm::vec3 origin = position + normal * BAKE_RAY_OFFSET;
+        glm::vec3 result = lightManager.getAmbientLight() * irradiance(lightManager.getAmbientIrradiance(), normal);
+
+        const DirectionalLight &directional = lightManager.getDirectionalLight();
+        glm::vec3 lightDir = -directional.direction;
+        float amount = diffuse(lightDir, normal) * directional.intensity;
+        if(amount > 0.0f && !occluded(origin, lightDir, sceneSize))
+            result += amount * directional.color;
+
+        for(unsigned int i = 0; i < lightManager.getPointLightCount(); i++)
+        {
+            const PointLight &light = lightManager.getPointLight(i);
+            if(!(light.flags & LIGHT_FLAG_STATIC))
+                continue;
+            result += pointContribution(light.position, light.color, origin, normal, 1.0f);
+        }
+        for(unsigned int i = 0; i < lightManager.getSpotLightCount(); i++)
+        {
+            const SpotLight &light = lightManager.getSpotLight(i);
+            if(!(light.flags & LIGHT_FLAG_STATIC))
+                continue;
+            glm::vec3 toLight = glm::normalize(glm::vec3(light.position) - position);
+            float cone = glm::clamp((glm::dot(-glm::vec3(light.direction), toLight) - light.direction.w) * light.invCutOffRange, 0.0f, 1.0f);
+            if(cone > 0.0f)
+                result += pointContribution(light.position, light.color, origin, normal, cone);
+        }
+        return result;
+    }
+
+    // position.w: range, color.w: 1 / range
+    glm::vec3 pointContribution(const glm::vec4 &lightPosition, const glm::vec4 &color, const glm::vec3 &origin,
+                                const glm::vec3 &normal, float scale) const
+    {
+        glm::vec3 toLight = glm::vec3(lightPosition) - origin;
+        float distance = glm::length(toLight);
+        if(distance <= 0.0f || distance >= lightPosition.w)
+            return glm::vec3(0.0f);
+        glm::vec3 lightDir = toLight / distance;
+        float amount = scale * diffuse(lightDir, normal) * window(distance * color.w) / (distance * distance);
+        if(amount <= 0.0f || occluded(origin, lightDir, distance))
+            return glm::vec3(0.0f);
+        return amount * glm::vec3(color);
+    }
+};
+
+#endif
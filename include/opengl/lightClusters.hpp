@@ -0,0 +1,92 @@
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include <glad/glad.h>
+
+#include <opengl/shader.hpp>
+#include <opengl/shaderPreprocessor.hpp>
+#include <opengl/glState.hpp>
+
+#include <string>
+
+#define LIGHT_CLUSTER_SHADER_PATH "../resources/shaders/light_cluster.cs"
+// shader storage bindings of the cluster lists, see lightCluster.glsl
+#define LIGHT_CLUSTER_COUNT_BINDING 6
+#define LIGHT_CLUSTER_INDEX_BINDING 7
+// froxel grid: screen tiles and exponential depth slices
+#define LIGHT_CLUSTER_X 16
+#define LIGHT_CLUSTER_Y 9
+#define LIGHT_CLUSTER_Z 24
+// lights a cluster holds, the ones binned after are dropped
+#define LIGHT_CLUSTER_MAX_LIGHTS 128
+
+// bins the point and spot lights into the clusters of the camera frustum once per frame
+// with light_cluster.cs, so a fragment only shades the lights whose range reaches its
+// cluster. every mirror gets its own set of clusters, holding the lights reflected in it.
+// the lists are written and read on the GPU only.
+class LightClusters
+{
+public:
+    // the culling program is built deferred, build() skips the pass until it is ready
+    LightClusters() : cullShader(Shader(LIGHT_CLUSTER_SHADER_PATH, getShaderDefines(), true))
+    {
+        glGenBuffers(1, &countBuffer);
+        glGenBuffers(1, &indexBuffer);
+    }
+
+    // defines of lightCluster.glsl, shared by the culling and the lighting programs
+    static ShaderDefines getShaderDefines()
+    {
+        ShaderDefines defines;
+        defines["LIGHT_CLUSTERS"] = "1";
+        defines["LIGHT_CLUSTER_X"] = std::to_string(LIGHT_CLUSTER_X);
+        defines["LIGHT_CLUSTER_Y"] = std::to_string(LIGHT_CLUSTER_Y);
+        defines["LIGHT_CLUSTER_Z"] = std::to_string(LIGHT_CLUSTER_Z);
+        defines["LIGHT_CLUSTER_MAX_LIGHTS"] = std::to_string(LIGHT_CLUSTER_MAX_LIGHTS);
+        return defines;
+    }
+
+    // rebuilds the lists of the camera and views - 1 mirrors. the frame constants, the
+    // lights and the reflect planes have to be bound. the lists stay empty while the
+    // program is compiling, so clustered programs only shade the directional light then.
+    void build(unsigned int views)
+    {
+        reserve(views);
+        bind();
+        if(!cullShader.isReady())
+            return;
+        cullShader.use();
+        glDispatchCompute(1, 1, LIGHT_CLUSTER_Z * views);
+        // the lists are read by the fragment shaders of this frame
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    void bind()
+    {
+        GLState &state = GLState::instance();
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_CLUSTER_COUNT_BINDING, countBuffer);
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_CLUSTER_INDEX_BINDING, indexBuffer);
+    }
+
+private:
+    Shader cullShader;
+    GLuint countBuffer, indexBuffer;
+    unsigned int capacity = 0;
+
+    // grows the lists to hold views sets of clusters, the counts start out empty
+    void reserve(unsigned int views)
+    {
+        if(views <= capacity)
+            return;
+        capacity = views;
+        GLsizeiptr clusters = static_cast<GLsizeiptr>(LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y * LIGHT_CLUSTER_Z) * views;
+        GLState &state = GLState::instance();
+        state.bindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, clusters * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+        state.bindBuffer(GL_SHADER_STORAGE_BUFFER, indexBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, clusters * LIGHT_CLUSTER_MAX_LIGHTS * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    }
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <opengl/camera.hpp>
+
+#include <cmath>
+
+// a level is used while its error projects to less than this many pixels
+#define LOD_PIXEL_ERROR 1.0f
+
+// everything a draw needs to pick a level of detail for its meshes
+struct LodContext
+{
+    // position the geometry is seen from
+    glm::vec3 viewPos = glm::vec3(0.0f);
+    // pixels covered by one unit at distance 1
+    float pixelsPerUnit = 0.0f;
+    // scales the allowed pixel error, > 1 picks coarser levels
+    float bias = 1.0f;
+
+    static LodContext fromCamera(Camera &camera, float bias = 1.0f)
+    {
+        LodContext context;
+        context.viewPos = camera.Position;
+        context.pixelsPerUnit = camera.resolution.y / (2.0f * std::tan(glm::radians(camera.Zoom) * 0.5f));
+        context.bias = bias;
+        return context;
+    }
+
+    // pixels per object space unit for a sphere at center, already scaled to world space
+    float pixelsPerUnitAt(const glm::vec3 &center, float radius, float scale) const
+    {
+        float distance = glm::length(center - viewPos) - radius;
+        // inside the bounds: full detail
+        if(distance <= 1e-4f)
+            return 1e30f;
+        return pixelsPerUnit * scale / distance;
+    }
+
+    float maxPixelError() const
+    {
+        return LOD_PIXEL_ERROR * bias;
+    }
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+// a texture of a material and the sampler uniform it is read through
+struct MaterialTexture
+{
+    std::string sampler;
+    GLenum target;
+    GLuint texture;
+};
+
+// the textures a mesh is drawn with. meshes with the same textures share an id: draws are
+// sorted and batched by it, and every shader keeps one binding table per id.
+struct Material
+{
+    // 0 is the material without textures
+    unsigned int id = 0;
+    std::vector<MaterialTexture> textures;
+
+    // an already registered texture set gets its existing id
+    static Material create(const std::vector<MaterialTexture> &textures)
+    {
+        static std::map<std::string, unsigned int> ids;
+        Material material;
+        material.textures = textures;
+        if(textures.empty())
+            return material;
+        std::string key;
+        for(const MaterialTexture &texture : textures)
+            key += texture.sampler + "=" + std::to_string(texture.target) + ":" + std::to_string(texture.texture) + ";";
+        auto inserted = ids.emplace(key, static_cast<unsigned int>(registered().size()));
+        material.id = inserted.first->second;
+        if(inserted.second)
+            registered().push_back(material);
+        return material;
+    }
+
+    // every material created so far, indexed by id. registered()[0] has no textures.
+    static std::vector<Material> &registered()
+    {
+        static std::vector<Material> materials(1);
+        return materials;
+    }
+
+    // the texture read through a sampler, 0 if the material has none
+    GLuint getTexture(const std::string &sampler) const
+    {
+        for(const MaterialTexture &texture : textures)
+            if(texture.sampler == sampler)
+                return texture.texture;
+        return 0;
+    }
+};
+
+#endif
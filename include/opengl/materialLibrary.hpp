@@ -0,0 +1,224 @@
+#ifndef MATERIALLIBRARY_H
+#define MATERIALLIBRARY_H
+
+#include <glad/glad.h>
+
+#include <opengl/material.hpp>
+#include <opengl/shader.hpp>
+#include <opengl/shaderPreprocessor.hpp>
+#include <opengl/glExtensions.hpp>
+#include <opengl/glState.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+using namespace std;
+
+// shader storage binding of the material records, see materials.glsl
+#define MATERIAL_DATA_BINDING 5
+// texture arrays a program can sample, each one takes a texture unit
+#define MATERIAL_MAX_ARRAYS 8
+#define MATERIAL_NO_TEXTURE 0xFFFFFFFFu
+
+// std430 layout of GL_MaterialData
+struct MaterialData
+{
+    // resident handle of the diffuse texture, bindless path only
+    uint64_t diffuseHandle;
+    // texture array and layer of the diffuse texture, texture array path only
+    uint32_t diffuseArray;
+    uint32_t diffuseLayer;
+};
+
+// the material textures of every registered material, addressable by material id from
+// programs compiled with getShaderDefines(). with GL_ARB_bindless_texture the diffuse
+// textures are made resident, otherwise they are copied into texture arrays, one per
+// size and format. draws then only carry a material index and no texture has to be bound
+// between them, so a DrawQueue merges them across materials.
+class MaterialLibrary
+{
+public:
+    // created on first use, a GL context must be current by then
+    static MaterialLibrary &instance()
+    {
+        static MaterialLibrary library;
+        return library;
+    }
+
+    // builds the table from Material::registered(), call once all models are loaded.
+    // materials created afterwards keep using bound textures.
+    void build()
+    {
+        const vector<Material> &materials = Material::registered();
+        records.assign(materials.size(), {0, MATERIAL_NO_TEXTURE, 0});
+        bindless = GLExtensions::bindlessTexture;
+        built = bindless ? buildHandles(materials) : buildArrays(materials);
+        if(!built)
+        {
+            for(GLuint array : arrays)
+                GLState::instance().deleteTexture(array);
+            arrays.clear();
+            arrayNames.clear();
+            std::cout << "WARNING::MATERIALLIBRARY::FALLBACK_TO_BOUND_TEXTURES" << std::endl;
+            return;
+        }
+
+        GLState &state = GLState::instance();
+        state.bindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(MaterialData), records.data(), GL_STATIC_DRAW);
+        std::cout << "Material table: " << materials.size() - 1 << " materials, "
+                  << (bindless ? "bindless" : std::to_string(arrays.size()) + " texture arrays") << std::endl;
+    }
+
+    bool available() const
+    {
+        return built;
+    }
+
+    // defines selecting the material table path in materials.glsl, empty if it is not available
+    ShaderDefines getShaderDefines() const
+    {
+        ShaderDefines defines;
+        if(!built)
+            return defines;
+        defines["MATERIAL_TABLE"] = "1";
+        if(bindless)
+            defines["MATERIAL_BINDLESS"] = "1";
+        else
+            defines["MATERIAL_ARRAY_COUNT"] = std::to_string(arrays.size());
+        return defines;
+    }
+
+    // binds the records and the texture arrays, the state cache drops repeated binds
+    void bind(const Shader &shader)
+    {
+        GLState::instance().bindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_DATA_BINDING, buffer);
+        for(unsigned int i = 0; i < arrays.size(); i++)
+            shader.bindTexture(arrayNames[i].c_str(), GL_TEXTURE_2D_ARRAY, arrays[i]);
+    }
+
+private:
+    GLuint buffer;
+    vector<MaterialData> records;
+    vector<GLuint> arrays;
+    // sampler names of the arrays, GL_MaterialArrays[i]
+    vector<string> arrayNames;
+    // resident handles, they stay resident for the lifetime of the context
+    vector<GLuint64> handles;
+    bool bindless = false;
+    bool built = false;
+
+    MaterialLibrary()
+    {
+        glGenBuffers(1, &buffer);
+    }
+
+    bool buildHandles(const vector<Material> &materials)
+    {
+        for(unsigned int id = 1; id < materials.size(); id++)
+        {
+            GLuint texture = materials[id].getTexture("texture_diffuse1");
+            if(texture == 0)
+                continue;
+            GLuint64 handle = GLExtensions::getTextureHandle(texture);
+            if(handle == 0)
+                return false;
+            // a handle is the same for every material sharing the texture, residency is not counted
+            if(std::find(handles.begin(), handles.end(), handle) == handles.end())
+            {
+                GLExtensions::makeTextureHandleResident(handle);
+                handles.push_back(handle);
+            }
+            records[id].diffuseHandle = handle;
+        }
+        return true;
+    }
+
+    // unsized formats are what TextureFromFile uploads with, storage needs a sized one
+    static GLenum sizedFormat(GLint format)
+    {
+        switch(format)
+        {
+            case GL_RED: return GL_R8;
+            case GL_RGB: return GL_RGB8;
+            case GL_RGBA: return GL_RGBA8;
+            default: return static_cast<GLenum>(format);
+        }
+    }
+
+    bool buildArrays(const vector<Material> &materials)
+    {
+        // distinct diffuse textures grouped by size, format and mip levels
+        typedef std::tuple<GLint, GLint, GLint, GLint> ArrayFormat;
+        map<ArrayFormat, vector<GLuint>> groups;
+        map<GLuint, ArrayFormat> formats;
+        for(unsigned int id = 1; id < materials.size(); id++)
+        {
+            GLuint texture = materials[id].getTexture("texture_diffuse1");
+            if(texture == 0 || formats.count(texture))
+                continue;
+            GLint width = 0, height = 0, format = 0, levels = 0;
+            glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_WIDTH, &width);
+            glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_HEIGHT, &height);
+            glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+            if(width == 0 || height == 0)
+                continue;
+            // TextureFromFile builds the full chain
+            while((std::max(width, height) >> levels) > 0)
+                levels++;
+            ArrayFormat key(width, height, format, levels);
+            formats[texture] = key;
+            groups[key].push_back(texture);
+        }
+
+        GLint maxLayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        map<GLuint, std::pair<uint32_t, uint32_t>> placement;
+        for(const auto &group : groups)
+        {
+            GLint width, height, format, levels;
+            std::tie(width, height, format, levels) = group.first;
+            const vector<GLuint> &textures = group.second;
+            for(size_t first = 0; first < textures.size(); first += maxLayers)
+            {
+                if(arrays.size() >= MATERIAL_MAX_ARRAYS)
+                    return false;
+                GLsizei layers = static_cast<GLsizei>(std::min(textures.size() - first, static_cast<size_t>(maxLayers)));
+                GLuint array;
+                glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &array);
+                glTextureStorage3D(array, levels, sizedFormat(format), width, height, layers);
+                // same sampling as TextureFromFile
+                glTextureParameteri(array, GL_TEXTURE_WRAP_S, GL_REPEAT);
+                glTextureParameteri(array, GL_TEXTURE_WRAP_T, GL_REPEAT);
+                glTextureParameteri(array, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                glTextureParameteri(array, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                for(GLsizei layer = 0; layer < layers; layer++)
+                {
+                    GLuint texture = textures[first + layer];
+                    for(GLint level = 0; level < levels; level++)
+                        glCopyImageSubData(texture, GL_TEXTURE_2D, level, 0, 0, 0, array, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+                                           std::max(width >> level, 1), std::max(height >> level, 1), 1);
+                    placement[texture] = {static_cast<uint32_t>(arrays.size()), static_cast<uint32_t>(layer)};
+                }
+                arrayNames.push_back("GL_MaterialArrays[" + std::to_string(arrays.size()) + "]");
+                arrays.push_back(array);
+            }
+        }
+
+        for(unsigned int id = 1; id < materials.size(); id++)
+        {
+            auto it = placement.find(materials[id].getTexture("texture_diffuse1"));
+            if(it == placement.end())
+                continue;
+            records[id].diffuseArray = it->second.first;
+            records[id].diffuseLayer = it->second.second;
+        }
+        return !arrays.empty();
+    }
+};
+
+#endif
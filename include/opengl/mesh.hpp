@@ -7,69 +7,145 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <opengl/shader.hpp>
+#include <opengl/material.hpp>
+#include <opengl/vertex.hpp>
+#include <opengl/geometryBuffer.hpp>
+#include <opengl/glState.hpp>
 
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
 using namespace std;
 
-#define MAX_BONE_INFLUENCE 4
-
-struct Vertex {
-    // position
-    glm::vec3 Position;
-    // normal
-    glm::vec3 Normal;
-    // texCoords
-    glm::vec2 TexCoords;
-    // tangent
-    glm::vec3 Tangent;
-    // bitangent
-    glm::vec3 Bitangent;
-	//bone indexes which will influence this vertex
-	int m_BoneIDs[MAX_BONE_INFLUENCE];
-	//weights from each bone
-	float m_Weights[MAX_BONE_INFLUENCE];
-};
-
 struct Texture {
     unsigned int id;
     string type;
     string path;
 };
 
+// a simplified index list over the mesh's vertices
+struct LodLevel {
+    vector<unsigned int> indices;
+    // object space error of the level
+    float error;
+};
+
+// where a level lives in the mesh's element buffer
+struct MeshLod {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    float error;
+};
+
 class Mesh {
 public:
     // mesh Data
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
+    // the textures under their sampler names (texture_diffuseN, ...), built once
+    Material             material;
+    // shared VAO of the geometry buffer this mesh is stored in
     unsigned int VAO;
 
+    // levels of detail, lods[0] is the full mesh. coarser levels are appended
+    // after the full index list in the element buffer and reuse the vertices.
+    vector<MeshLod>      lods;
+    vector<unsigned int> lodIndices;
+
+    // object space bounding sphere
+    glm::vec3 boundsCenter = glm::vec3(0.0f);
+    float boundsRadius = 0.0f;
+
+    // depth-only data: tightly packed positions with their own index list.
+    // vertices that only differ in normal/uv/tangent share one position here.
+    vector<glm::vec3>    depthPositions;
+    vector<unsigned int> depthIndices;
+    unsigned int depthVAO = 0;
+
+    // type of the indices on the GPU, 16 bit whenever the vertices fit
+    GLenum indexType = GL_UNSIGNED_INT;
+    GLenum depthIndexType = GL_UNSIGNED_INT;
+
+    // location inside the GeometryBuffer pools
+    int baseVertex = 0;
+    unsigned int firstIndex = 0;
+    int depthBaseVertex = 0;
+    unsigned int depthFirstIndex = 0;
+
     // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, bool depthStream = true, vector<LodLevel> lodLevels = {})
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
 
+        lods.push_back({0, static_cast<unsigned int>(indices.size()), 0.0f});
+        for(const LodLevel &level : lodLevels)
+        {
+            lods.push_back({static_cast<unsigned int>(indices.size() + lodIndices.size()), static_cast<unsigned int>(level.indices.size()), level.error});
+            lodIndices.insert(lodIndices.end(), level.indices.begin(), level.indices.end());
+        }
+        computeBounds();
+        setupMaterial();
+
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
+        if(depthStream)
+            setupDepthStream();
+    }
+
+    // picks the coarsest level whose error stays below maxPixelError, given how many
+    // pixels one object space unit covers at the mesh's distance
+    int selectLod(float pixelsPerUnit, float maxPixelError) const
+    {
+        int lod = 0;
+        for(int i = 1; i < static_cast<int>(lods.size()); i++)
+        {
+            if(lods[i].error * pixelsPerUnit > maxPixelError)
+                break;
+            lod = i;
+        }
+        return lod;
+    }
+
+    // true if both meshes bind the same textures, so their draws can share one multi-draw
+    bool sameMaterial(const Mesh &other) const
+    {
+        return material.id == other.material.id;
     }
 
-    // render the mesh
-    void Draw(Shader &shader, int textureOffset = 0) 
+    // indirect draw command of a level
+    DrawElementsIndirectCommand getCommand(int lod = 0) const
     {
-        // bind appropriate textures
+        const MeshLod &level = lods[lod < static_cast<int>(lods.size()) ? lod : lods.size() - 1];
+        return {level.indexCount, 1, firstIndex + level.firstIndex, baseVertex, 0};
+    }
+
+    // indirect draw command of the depth stream, the full mesh if there is none
+    DrawElementsIndirectCommand getDepthCommand() const
+    {
+        if(depthVAO == 0)
+            return getCommand(0);
+        return {static_cast<unsigned int>(depthIndices.size()), 1, depthFirstIndex, depthBaseVertex, 0};
+    }
+
+private:
+
+    void setupMaterial()
+    {
+        // retrieve texture number (the N in diffuse_textureN)
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr   = 1;
         unsigned int heightNr   = 1;
+        vector<MaterialTexture> materialTextures;
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + textureOffset + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
             string number;
-            string name = textures[i].type;
+            const string &name = textures[i].type;
             if(name == "texture_diffuse")
                 number = std::to_string(diffuseNr++);
             else if(name == "texture_specular")
@@ -78,69 +154,94 @@ public:
                 number = std::to_string(normalNr++); // transfer unsigned int to string
              else if(name == "texture_height")
                 number = std::to_string(heightNr++); // transfer unsigned int to string
+            materialTextures.push_back({name + number, GL_TEXTURE_2D, textures[i].id});
+        }
+        material = Material::create(materialTextures);
+    }
 
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), textureOffset + i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+    void computeBounds()
+    {
+        if(vertices.empty())
+            return;
+        glm::vec3 minPos = vertices[0].Position, maxPos = vertices[0].Position;
+        for(const Vertex &vertex : vertices)
+        {
+            minPos = glm::min(minPos, vertex.Position);
+            maxPos = glm::max(maxPos, vertex.Position);
         }
-        
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+        boundsCenter = (minPos + maxPos) * 0.5f;
+        boundsRadius = 0.0f;
+        for(const Vertex &vertex : vertices)
+            boundsRadius = glm::max(boundsRadius, glm::length(vertex.Position - boundsCenter));
     }
 
-private:
-    // render data 
-    unsigned int VBO, EBO;
+    // indices are stored as 16 bit whenever the vertices fit
+    static GLenum chooseIndexType(size_t vertexCount)
+    {
+        return vertexCount < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    struct PositionHash
+    {
+        size_t operator()(const glm::vec3 &p) const
+        {
+            // adding 0 turns -0.0 into +0.0 so equal positions hash equally
+            glm::vec3 q = p + glm::vec3(0.0f);
+            uint32_t bits[3];
+            std::memcpy(bits, &q[0], sizeof(bits));
+            size_t h = bits[0];
+            h = h * 0x9E3779B1u ^ bits[1];
+            h = h * 0x9E3779B1u ^ bits[2];
+            return h;
+        }
+    };
+
+    // builds the de-interleaved position stream. positions are welded so the
+    // post-transform cache can hit across uv/normal seams, then stored in first-use
+    // order of the index list to keep fetches sequential.
+    void setupDepthStream()
+    {
+        if(vertices.empty() || indices.empty())
+            return;
+
+        unordered_map<glm::vec3, unsigned int, PositionHash> positionIndex;
+        positionIndex.reserve(vertices.size());
+        depthPositions.clear();
+        depthIndices.resize(indices.size());
+        for(unsigned int i = 0; i < indices.size(); i++)
+        {
+            const glm::vec3 &p = vertices[indices[i]].Position;
+            auto it = positionIndex.find(p);
+            if(it == positionIndex.end())
+            {
+                it = positionIndex.emplace(p, static_cast<unsigned int>(depthPositions.size())).first;
+                depthPositions.push_back(p);
+            }
+            depthIndices[i] = it->second;
+        }
 
-    // initializes all the buffer objects/arrays
+        // vertex Positions only, 12 bytes per vertex instead of sizeof(Vertex)
+        GeometryBuffer &geometry = GeometryBuffer::instance();
+        depthIndexType = chooseIndexType(depthPositions.size());
+        depthBaseVertex = geometry.addVertices(VERTEX_FORMAT_POSITION, depthPositions.data(), depthPositions.size());
+        depthFirstIndex = geometry.addIndices(depthIndices, depthIndexType);
+        depthVAO = geometry.getVAO(VERTEX_FORMAT_POSITION, depthIndexType);
+    }
+
+    // suballocates the vertices and all levels' indices from the shared geometry buffer
     void setupMesh()
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        GeometryBuffer &geometry = GeometryBuffer::instance();
+        indexType = chooseIndexType(vertices.size());
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);	
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);	
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);	
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-		// ids
-		glEnableVertexAttribArray(5);
-		glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
-
-		// weights
-		glEnableVertexAttribArray(6);
-		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
+        baseVertex = geometry.addVertices(VERTEX_FORMAT_FULL, vertices.data(), vertices.size());
+
+        vector<unsigned int> allIndices(indices);
+        allIndices.insert(allIndices.end(), lodIndices.begin(), lodIndices.end());
+        firstIndex = geometry.addIndices(allIndices, indexType);
+        VAO = geometry.getVAO(VERTEX_FORMAT_FULL, indexType);
     }
 };
 #endif
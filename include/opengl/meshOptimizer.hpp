@@ -0,0 +1,371 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include <opengl/mesh.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// size of the LRU cache the vertex cache optimizer targets
+#define OPTIMIZER_CACHE_SIZE 32
+// size of the FIFO cache used to estimate vertex shader invocations
+#define OPTIMIZER_FIFO_SIZE 16
+
+struct MeshOptimizeStats
+{
+    size_t verticesBefore = 0;
+    size_t verticesAfter = 0;
+    size_t indexCount = 0;
+    // estimated vertex shader invocations (post-transform cache misses)
+    size_t transformsBefore = 0;
+    size_t transformsAfter = 0;
+    size_t indexBytesBefore = 0;
+    size_t indexBytesAfter = 0;
+
+    void accumulate(const MeshOptimizeStats &other)
+    {
+        verticesBefore += other.verticesBefore;
+        verticesAfter += other.verticesAfter;
+        indexCount += other.indexCount;
+        transformsBefore += other.transformsBefore;
+        transformsAfter += other.transformsAfter;
+        indexBytesBefore += other.indexBytesBefore;
+        indexBytesAfter += other.indexBytesAfter;
+    }
+
+    // average cache miss ratio: vertex shader invocations per triangle
+    float acmrBefore() const
+    {
+        return indexCount ? 3.0f * transformsBefore / indexCount : 0.0f;
+    }
+
+    float acmrAfter() const
+    {
+        return indexCount ? 3.0f * transformsAfter / indexCount : 0.0f;
+    }
+};
+
+// import-time optimization of indexed triangle lists. the whole pipeline is
+// run by optimize(); the stages can also be used separately.
+class MeshOptimizer
+{
+public:
+    // welds duplicated vertices, reorders triangles for the post-transform cache and
+    // for overdraw, then reorders vertices for fetch locality.
+    static MeshOptimizeStats optimize(vector<Vertex> &vertices, vector<unsigned int> &indices)
+    {
+        MeshOptimizeStats stats;
+        stats.verticesBefore = vertices.size();
+        stats.indexCount = indices.size();
+        stats.transformsBefore = simulateTransforms(indices, vertices.size());
+        stats.indexBytesBefore = indices.size() * sizeof(unsigned int);
+
+        weldVertices(vertices, indices);
+        optimizeVertexCache(indices, vertices.size());
+        optimizeOverdraw(vertices, indices);
+        optimizeVertexFetch(vertices, indices);
+
+        stats.verticesAfter = vertices.size();
+        stats.transformsAfter = simulateTransforms(indices, vertices.size());
+        stats.indexBytesAfter = indices.size() * (vertices.size() < 65536 ? sizeof(uint16_t) : sizeof(uint32_t));
+        return stats;
+    }
+
+    // merges bitwise identical vertices. Vertex must be fully initialized (no garbage in unused fields).
+    static void weldVertices(vector<Vertex> &vertices, vector<unsigned int> &indices)
+    {
+        unordered_map<Vertex, unsigned int, VertexHash, VertexEqual> unique;
+        unique.reserve(vertices.size());
+        vector<unsigned int> remap(vertices.size());
+        vector<Vertex> welded;
+        welded.reserve(vertices.size());
+        for(unsigned int i = 0; i < vertices.size(); i++)
+        {
+            auto it = unique.emplace(vertices[i], static_cast<unsigned int>(welded.size()));
+            if(it.second)
+                welded.push_back(vertices[i]);
+            remap[i] = it.first->second;
+        }
+        for(unsigned int &index : indices)
+            index = remap[index];
+        vertices.swap(welded);
+    }
+
+    // Forsyth's linear-speed vertex cache optimization
+    static void optimizeVertexCache(vector<unsigned int> &indices, size_t vertexCount)
+    {
+        size_t triCount = indices.size() / 3;
+        if(triCount == 0)
+            return;
+
+        // vertex -> triangle adjacency, the first liveTris[v] entries are the triangles not yet emitted
+        vector<unsigned int> liveTris(vertexCount, 0);
+        for(unsigned int index : indices)
+            liveTris[index]++;
+        vector<unsigned int> offsets(vertexCount + 1, 0);
+        for(size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] = offsets[v] + liveTris[v];
+        vector<unsigned int> adjacency(indices.size());
+        vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for(size_t t = 0; t < triCount; t++)
+            for(int k = 0; k < 3; k++)
+                adjacency[fill[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+
+        vector<int> cachePos(vertexCount, -1);
+        vector<float> vertexScores(vertexCount);
+        for(size_t v = 0; v < vertexCount; v++)
+            vertexScores[v] = vertexScore(-1, liveTris[v]);
+        vector<float> triScores(triCount);
+        for(size_t t = 0; t < triCount; t++)
+            triScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+
+        vector<char> emitted(triCount, 0);
+        vector<unsigned int> cache, newCache;
+        cache.reserve(OPTIMIZER_CACHE_SIZE + 3);
+        newCache.reserve(OPTIMIZER_CACHE_SIZE + 3);
+        vector<unsigned int> result;
+        result.reserve(indices.size());
+
+        size_t cursor = 0;
+        long best = -1;
+        while(result.size() < triCount * 3)
+        {
+            if(best < 0)
+            {
+                // nothing adjacent to the cache, restart from the next triangle in input order
+                while(emitted[cursor])
+                    cursor++;
+                best = static_cast<long>(cursor);
+            }
+
+            const unsigned int *tri = &indices[best * 3];
+            emitted[best] = 1;
+            for(int k = 0; k < 3; k++)
+            {
+                unsigned int v = tri[k];
+                result.push_back(v);
+                // remove the triangle from the live part of v's adjacency
+                unsigned int *begin = &adjacency[offsets[v]];
+                unsigned int *end = begin + liveTris[v];
+                unsigned int *found = std::find(begin, end, static_cast<unsigned int>(best));
+                if(found != end)
+                {
+                    std::swap(*found, *(end - 1));
+                    liveTris[v]--;
+                }
+            }
+
+            // the emitted vertices move to the front of the cache
+            newCache.clear();
+            newCache.insert(newCache.end(), tri, tri + 3);
+            for(unsigned int v : cache)
+                if(v != tri[0] && v != tri[1] && v != tri[2])
+                    newCache.push_back(v);
+            for(size_t i = 0; i < newCache.size(); i++)
+            {
+                unsigned int v = newCache[i];
+                cachePos[v] = i < OPTIMIZER_CACHE_SIZE ? static_cast<int>(i) : -1;
+                float score = vertexScore(cachePos[v], liveTris[v]);
+                float delta = score - vertexScores[v];
+                vertexScores[v] = score;
+                for(unsigned int j = 0; j < liveTris[v]; j++)
+                    triScores[adjacency[offsets[v] + j]] += delta;
+            }
+            if(newCache.size() > OPTIMIZER_CACHE_SIZE)
+                newCache.resize(OPTIMIZER_CACHE_SIZE);
+            cache.swap(newCache);
+
+            // next triangle is the best scored one touching the cache
+            best = -1;
+            float bestScore = -1.0f;
+            for(unsigned int v : cache)
+            {
+                for(unsigned int j = 0; j < liveTris[v]; j++)
+                {
+                    unsigned int t = adjacency[offsets[v] + j];
+                    if(triScores[t] > bestScore)
+                    {
+                        bestScore = triScores[t];
+                        best = t;
+                    }
+                }
+            }
+        }
+        // indices past the last whole triangle are not a triangle, they stay at the end
+        result.insert(result.end(), indices.begin() + triCount * 3, indices.end());
+        indices.swap(result);
+    }
+
+    // Tipsify-style overdraw ordering: the cache optimized list is cut into clusters at
+    // cache restarts, then clusters facing away from the mesh center are drawn first so
+    // they occlude the rest. The order inside a cluster is kept, so cache efficiency stays.
+    static void optimizeOverdraw(const vector<Vertex> &vertices, vector<unsigned int> &indices)
+    {
+        size_t triCount = indices.size() / 3;
+        if(triCount < 2)
+            return;
+
+        // cluster boundaries: triangles whose three vertices all miss the cache
+        vector<size_t> clusters;
+        {
+            vector<unsigned int> timestamps(vertices.size(), 0);
+            unsigned int time = OPTIMIZER_FIFO_SIZE + 1;
+            for(size_t t = 0; t < triCount; t++)
+            {
+                int misses = 0;
+                for(int k = 0; k < 3; k++)
+                {
+                    unsigned int v = indices[t * 3 + k];
+                    if(time - timestamps[v] > OPTIMIZER_FIFO_SIZE)
+                    {
+                        timestamps[v] = time++;
+                        misses++;
+                    }
+                }
+                if(t == 0 || misses == 3)
+                    clusters.push_back(t);
+            }
+        }
+        if(clusters.size() < 2)
+            return;
+
+        glm::vec3 meshCenter(0.0f);
+        float meshArea = 0.0f;
+        vector<float> sortKeys(clusters.size());
+        vector<glm::vec3> clusterCenters(clusters.size(), glm::vec3(0.0f));
+        vector<glm::vec3> clusterNormals(clusters.size(), glm::vec3(0.0f));
+        for(size_t c = 0; c < clusters.size(); c++)
+        {
+            size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triCount;
+            float clusterArea = 0.0f;
+            for(size_t t = clusters[c]; t < end; t++)
+            {
+                const glm::vec3 &p0 = vertices[indices[t * 3]].Position;
+                const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+                float area = glm::length(n);
+                glm::vec3 center = (p0 + p1 + p2) / 3.0f;
+                clusterCenters[c] += center * area;
+                clusterNormals[c] += n;
+                clusterArea += area;
+            }
+            meshCenter += clusterCenters[c];
+            meshArea += clusterArea;
+            if(clusterArea > 0.0f)
+                clusterCenters[c] /= clusterArea;
+        }
+        if(meshArea > 0.0f)
+            meshCenter /= meshArea;
+
+        for(size_t c = 0; c < clusters.size(); c++)
+        {
+            float length = glm::length(clusterNormals[c]);
+            glm::vec3 normal = length > 0.0f ? clusterNormals[c] / length : glm::vec3(0.0f);
+            sortKeys[c] = glm::dot(clusterCenters[c] - meshCenter, normal);
+        }
+
+        vector<size_t> order(clusters.size());
+        for(size_t c = 0; c < order.size(); c++)
+            order[c] = c;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+        vector<unsigned int> result;
+        result.reserve(indices.size());
+        for(size_t c : order)
+        {
+            size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triCount;
+            result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + end * 3);
+        }
+        result.insert(result.end(), indices.begin() + triCount * 3, indices.end());
+        indices.swap(result);
+    }
+
+    // stores vertices in the order the index buffer first references them, unreferenced vertices are dropped
+    static void optimizeVertexFetch(vector<Vertex> &vertices, vector<unsigned int> &indices)
+    {
+        vector<unsigned int> remap(vertices.size(), ~0u);
+        vector<Vertex> result;
+        result.reserve(vertices.size());
+        for(unsigned int &index : indices)
+        {
+            if(remap[index] == ~0u)
+            {
+                remap[index] = static_cast<unsigned int>(result.size());
+                result.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+        vertices.swap(result);
+    }
+
+    // number of vertex shader invocations for a FIFO post-transform cache
+    static size_t simulateTransforms(const vector<unsigned int> &indices, size_t vertexCount)
+    {
+        vector<unsigned int> timestamps(vertexCount, 0);
+        unsigned int time = OPTIMIZER_FIFO_SIZE + 1;
+        size_t misses = 0;
+        for(unsigned int index : indices)
+        {
+            if(time - timestamps[index] > OPTIMIZER_FIFO_SIZE)
+            {
+                timestamps[index] = time++;
+                misses++;
+            }
+        }
+        return misses;
+    }
+
+private:
+    struct VertexHash
+    {
+        size_t operator()(const Vertex &v) const
+        {
+            // FNV-1a over the raw bytes
+            const unsigned char *bytes = reinterpret_cast<const unsigned char*>(&v);
+            uint64_t h = 14695981039346656037ull;
+            for(size_t i = 0; i < sizeof(Vertex); i++)
+            {
+                h ^= bytes[i];
+                h *= 1099511628211ull;
+            }
+            return static_cast<size_t>(h);
+        }
+    };
+
+    struct VertexEqual
+    {
+        bool operator()(const Vertex &a, const Vertex &b) const
+        {
+            return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+        }
+    };
+
+    static float vertexScore(int cachePosition, unsigned int remainingTris)
+    {
+        if(remainingTris == 0)
+            return -1.0f;
+
+        float score = 0.0f;
+        if(cachePosition >= 0)
+        {
+            if(cachePosition < 3)
+                // the last triangle's vertices get a fixed score so the strip does not just bounce back
+                score = 0.75f;
+            else
+                score = std::pow(1.0f - float(cachePosition - 3) / float(OPTIMIZER_CACHE_SIZE - 3), 1.5f);
+        }
+        // boost vertices with few triangles left so lone triangles are not left behind
+        score += 2.0f / std::sqrt(float(remainingTris));
+        return score;
+    }
+};
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef MESHSIMPLIFIER_H
+#define MESHSIMPLIFIER_H
+
+#include <glm/glm.hpp>
+
+#include <opengl/mesh.hpp>
+#include <opengl/meshOptimizer.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// number of levels generated below the full mesh
+#define LOD_MAX_LEVELS 4
+// each level keeps this fraction of the previous level's triangles
+#define LOD_REDUCTION 0.5f
+// stop generating levels when a level can not reach this fraction of the previous one
+#define LOD_MIN_REDUCTION 0.85f
+
+// quadric error metric edge collapse simplifier (Garland & Heckbert).
+// edges collapse onto one of their end points, so every level reuses the vertex buffer
+// of the full mesh and only needs its own index list.
+class MeshSimplifier
+{
+public:
+    // builds the coarser levels of a mesh, the full mesh itself is not included
+    static vector<LodLevel> buildLods(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+    {
+        vector<LodLevel> levels;
+        vector<unsigned int> current = indices;
+        float error = 0.0f;
+        for(int i = 0; i < LOD_MAX_LEVELS; i++)
+        {
+            size_t target = static_cast<size_t>(current.size() / 3 * LOD_REDUCTION) * 3;
+            if(target < 3)
+                break;
+            vector<unsigned int> simplified = simplify(vertices, current, target, error);
+            if(simplified.empty() || simplified.size() > current.size() * LOD_MIN_REDUCTION)
+                break;
+            MeshOptimizer::optimizeVertexCache(simplified, vertices.size());
+            levels.push_back({simplified, error});
+            current.swap(simplified);
+        }
+        return levels;
+    }
+
+    // reduces the index list to at most targetIndexCount indices if the topology allows it.
+    // error is raised to the object space error of the result.
+    static vector<unsigned int> simplify(const vector<Vertex> &vertices, const vector<unsigned int> &indices, size_t targetIndexCount, float &error)
+    {
+        size_t vertexCount = vertices.size();
+        vector<unsigned int> result = indices;
+
+        vector<char> locked = findLockedVertices(vertices, indices);
+
+        // every vertex starts with the planes of its triangles
+        vector<Quadric> quadrics(vertexCount);
+        for(size_t t = 0; t < indices.size() / 3; t++)
+        {
+            unsigned int a = indices[t * 3], b = indices[t * 3 + 1], c = indices[t * 3 + 2];
+            Quadric q = Quadric::fromTriangle(vertices[a].Position, vertices[b].Position, vertices[c].Position);
+            quadrics[a].add(q);
+            quadrics[b].add(q);
+            quadrics[c].add(q);
+        }
+
+        double maxCost = double(error) * double(error);
+        vector<Collapse> collapses;
+        vector<unsigned int> remap(vertexCount);
+        vector<char> touched(vertexCount);
+        vector<unsigned int> triOffsets, triAdjacency;
+        while(result.size() > targetIndexCount)
+        {
+            buildAdjacency(result, vertexCount, triOffsets, triAdjacency);
+
+            // rank all edges by the cost of their cheapest legal collapse
+            collapses.clear();
+            for(size_t t = 0; t < result.size() / 3; t++)
+            {
+                for(int k = 0; k < 3; k++)
+                {
+                    unsigned int a = result[t * 3 + k], b = result[t * 3 + (k + 1) % 3];
+                    // each interior edge is seen twice, keep one direction
+                    if(a > b)
+                        continue;
+                    Collapse best = {0, 0, -1.0};
+                    if(!locked[a])
+                        best = {a, b, collapseCost(quadrics, vertices, a, b)};
+                    if(!locked[b])
+                    {
+                        double cost = collapseCost(quadrics, vertices, b, a);
+                        if(best.cost < 0.0 || cost < best.cost)
+                            best = {b, a, cost};
+                    }
+                    if(best.cost >= 0.0)
+                        collapses.push_back(best);
+                }
+            }
+            if(collapses.empty())
+                break;
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse &x, const Collapse &y) { return x.cost < y.cost; });
+
+            // collapse greedily, a vertex is touched at most once per pass
+            for(size_t v = 0; v < vertexCount; v++)
+                remap[v] = static_cast<unsigned int>(v);
+            std::fill(touched.begin(), touched.end(), 0);
+            size_t removeTriangles = (result.size() - targetIndexCount) / 3;
+            size_t removed = 0;
+            size_t applied = 0;
+            for(const Collapse &collapse : collapses)
+            {
+                if(removed >= removeTriangles)
+                    break;
+                if(touched[collapse.from] || touched[collapse.to])
+                    continue;
+                if(flipsTriangle(vertices, result, triOffsets, triAdjacency, collapse.from, collapse.to))
+                    continue;
+
+                remap[collapse.from] = collapse.to;
+                quadrics[collapse.to].add(quadrics[collapse.from]);
+                maxCost = std::max(maxCost, collapse.cost);
+                // lock the whole one-ring so the flip test stays valid for the rest of the pass
+                for(unsigned int i = triOffsets[collapse.from]; i < triOffsets[collapse.from + 1]; i++)
+                {
+                    unsigned int t = triAdjacency[i];
+                    bool shared = false;
+                    for(int k = 0; k < 3; k++)
+                    {
+                        touched[result[t * 3 + k]] = 1;
+                        shared |= result[t * 3 + k] == collapse.to;
+                    }
+                    removed += shared;
+                }
+                applied++;
+            }
+            if(applied == 0)
+                break;
+
+            // apply the collapses and drop triangles that became degenerate
+            size_t write = 0;
+            for(size_t t = 0; t < result.size() / 3; t++)
+            {
+                unsigned int a = remap[result[t * 3]], b = remap[result[t * 3 + 1]], c = remap[result[t * 3 + 2]];
+                if(a == b || b == c || c == a)
+                    continue;
+                result[write++] = a;
+                result[write++] = b;
+                result[write++] = c;
+            }
+            result.resize(write);
+        }
+
+        error = static_cast<float>(std::sqrt(maxCost));
+        return result;
+    }
+
+private:
+    struct Quadric
+    {
+        // upper triangle of the symmetric 4x4 matrix, plus the accumulated area weight
+        double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+        double a11 = 0, a12 = 0, a13 = 0;
+        double a22 = 0, a23 = 0;
+        double a33 = 0;
+        double weight = 0;
+
+        static Quadric fromTriangle(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2)
+        {
+            Quadric q;
+            glm::dvec3 n = glm::cross(glm::dvec3(p1) - glm::dvec3(p0), glm::dvec3(p2) - glm::dvec3(p0));
+            double area = glm::length(n);
+            if(area <= 0.0)
+                return q;
+            n /= area;
+            double d = -glm::dot(n, glm::dvec3(p0));
+            q.a00 = n.x * n.x * area; q.a01 = n.x * n.y * area; q.a02 = n.x * n.z * area; q.a03 = n.x * d * area;
+            q.a11 = n.y * n.y * area; q.a12 = n.y * n.z * area; q.a13 = n.y * d * area;
+            q.a22 = n.z * n.z * area; q.a23 = n.z * d * area;
+            q.a33 = d * d * area;
+            q.weight = area;
+            return q;
+        }
+
+        void add(const Quadric &q)
+        {
+            a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+            a11 += q.a11; a12 += q.a12; a13 += q.a13;
+            a22 += q.a22; a23 += q.a23;
+            a33 += q.a33;
+            weight += q.weight;
+        }
+
+        // area weighted mean squared distance of p to the planes
+        double evaluate(const glm::vec3 &p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+                     + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+                     + a22 * z * z + 2 * a23 * z
+                     + a33;
+            return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+        }
+    };
+
+    struct Collapse
+    {
+        unsigned int from;
+        unsigned int to;
+        double cost;
+    };
+
+    static double collapseCost(const vector<Quadric> &quadrics, const vector<Vertex> &vertices, unsigned int from, unsigned int to)
+    {
+        Quadric q = quadrics[from];
+        q.add(quadrics[to]);
+        return q.evaluate(vertices[to].Position);
+    }
+
+    static void buildAdjacency(const vector<unsigned int> &indices, size_t vertexCount, vector<unsigned int> &offsets, vector<unsigned int> &adjacency)
+    {
+        offsets.assign(vertexCount + 1, 0);
+        for(unsigned int index : indices)
+            offsets[index + 1]++;
+        for(size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] += offsets[v];
+        adjacency.resize(indices.size());
+        vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for(size_t i = 0; i < indices.size(); i++)
+            adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+    }
+
+    // true if moving 'from' onto 'to' turns any surviving triangle around
+    static bool flipsTriangle(const vector<Vertex> &vertices, const vector<unsigned int> &indices,
+                              const vector<unsigned int> &offsets, const vector<unsigned int> &adjacency,
+                              unsigned int from, unsigned int to)
+    {
+        for(unsigned int i = offsets[from]; i < offsets[from + 1]; i++)
+        {
+            const unsigned int *tri = &indices[adjacency[i] * 3];
+            if(tri[0] == to || tri[1] == to || tri[2] == to)
+                continue;
+            glm::vec3 p[3], q[3];
+            for(int k = 0; k < 3; k++)
+            {
+                p[k] = vertices[tri[k]].Position;
+                q[k] = tri[k] == from ? vertices[to].Position : p[k];
+            }
+            glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+            if(glm::dot(before, after) <= 0.0f)
+                return true;
+        }
+        return false;
+    }
+
+    // vertices on open borders or on attribute seams (several vertices sharing one position)
+    // are kept in place, otherwise the silhouette and uv seams would tear.
+    static vector<char> findLockedVertices(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+    {
+        vector<char> locked(vertices.size(), 0);
+
+        // map each vertex to the first vertex with the same position
+        struct PositionHash
+        {
+            size_t operator()(const glm::vec3 &p) const
+            {
+                std::hash<float> h;
+                return h(p.x) ^ (h(p.y) * 31) ^ (h(p.z) * 131);
+            }
+        };
+        unordered_map<glm::vec3, unsigned int, PositionHash> firstAt;
+        firstAt.reserve(vertices.size());
+        vector<unsigned int> wedge(vertices.size());
+        for(unsigned int v = 0; v < vertices.size(); v++)
+        {
+            auto it = firstAt.emplace(vertices[v].Position, v);
+            wedge[v] = it.first->second;
+            if(!it.second)
+            {
+                locked[v] = 1;
+                locked[it.first->second] = 1;
+            }
+        }
+
+        // directed edges without a twin are borders
+        unordered_map<uint64_t, int> edges;
+        edges.reserve(indices.size());
+        for(size_t t = 0; t < indices.size() / 3; t++)
+        {
+            for(int k = 0; k < 3; k++)
+            {
+                uint64_t a = wedge[indices[t * 3 + k]], b = wedge[indices[t * 3 + (k + 1) % 3]];
+                uint64_t key = a < b ? (a << 32 | b) : (b << 32 | a);
+                edges[key]++;
+            }
+        }
+        for(size_t t = 0; t < indices.size() / 3; t++)
+        {
+            for(int k = 0; k < 3; k++)
+            {
+                unsigned int a = indices[t * 3 + k], b = indices[t * 3 + (k + 1) % 3];
+                uint64_t wa = wedge[a], wb = wedge[b];
+                uint64_t key = wa < wb ? (wa << 32 | wb) : (wb << 32 | wa);
+                if(edges[key] != 2)
+                {
+                    locked[a] = 1;
+                    locked[b] = 1;
+                }
+            }
+        }
+        return locked;
+    }
+};
+
+#endif
@@ -11,7 +11,12 @@
 #include <assimp/postprocess.h>
 
 #include <opengl/mesh.hpp>
+#include <opengl/meshOptimizer.hpp>
+#include <opengl/meshSimplifier.hpp>
 #include <opengl/shader.hpp>
+#include <opengl/lod.hpp>
+#include <opengl/drawQueue.hpp>
+#include <opengl/objectBuffer.hpp>
 
 #include <string>
 #include <fstream>
@@ -19,8 +24,13 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <cstdint>
 using namespace std;
 
+// simplified levels are cached next to the model file with this suffix
+#define LOD_CACHE_SUFFIX ".lod"
+#define LOD_CACHE_VERSION 1
+
 unsigned int TextureFromFile(const char *path, const string &directory, bool flip);
 
 class Model 
@@ -29,6 +39,7 @@ public:
     // model data 
     vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh>    meshes;
+    string path;
     string directory;
 
     glm::vec3 position;
@@ -37,9 +48,13 @@ public:
 
     // flip texture when loading
     bool flip;
+    // keep a position-only stream per mesh for depth-only passes
+    bool depthStream;
+    // moves at runtime: its shadows are redrawn every frame instead of cached
+    bool dynamic = false;
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool flip = true) : position(glm::vec3(0)), scale(glm::vec3(1)), rotation(glm::quat(1,0,0,0)), flip(flip)
+    Model(string const &path, bool flip = true, bool depthStream = true) : position(glm::vec3(0)), scale(glm::vec3(1)), rotation(glm::quat(1,0,0,0)), flip(flip), depthStream(depthStream)
     {
         loadModel(path);
     }
@@ -49,33 +64,116 @@ public:
         rotation = glm::angleAxis(glm::radians(angle), axis) * rotation;
     }
 
+    // the matrices are cached and only rebuilt after position, scale or rotation changed
     glm::mat4 getModelMatrix()
     {
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, position);
-        model = glm::scale(model, scale);
-        model = model * glm::mat4_cast(rotation);
-        return model;
+        object.update(position, scale, rotation);
+        return object.getModelMatrix();
+    }
+
+    glm::mat4 getNormalMatrix()
+    {
+        object.update(position, scale, rotation);
+        return object.getNormalMatrix();
+    }
+
+    // rebuilds the transform if position, scale or rotation changed. call once per frame
+    // before ObjectBuffer::flush, a transform changed later reaches the GPU a frame late.
+    void updateTransform()
+    {
+        object.update(position, scale, rotation);
+    }
+
+    // index of the model's transform in the ObjectBuffer, kept up to date
+    unsigned int getObjectIndex()
+    {
+        object.update(position, scale, rotation);
+        return object.getIndex();
+    }
+
+    // what the import-time optimization of the meshes saved
+    const MeshOptimizeStats &getOptimizeStats() const
+    {
+        return optimizeStats;
+    }
+
+    float getMaxScale()
+    {
+        return glm::max(glm::abs(scale.x), glm::max(glm::abs(scale.y), glm::abs(scale.z)));
+    }
+
+    // world space bounding sphere of a mesh
+    void getMeshBounds(const Mesh &mesh, glm::vec3 &center, float &radius)
+    {
+        center = glm::vec3(getModelMatrix() * glm::vec4(mesh.boundsCenter, 1.0f));
+        radius = mesh.boundsRadius * getMaxScale();
+    }
+
+    // world space bounding sphere around all meshes
+    void getBounds(glm::vec3 &center, float &radius)
+    {
+        glm::vec3 minPos(INFINITY), maxPos(-INFINITY);
+        for(const Mesh &mesh : meshes)
+        {
+            glm::vec3 meshCenter;
+            float meshRadius;
+            getMeshBounds(mesh, meshCenter, meshRadius);
+            minPos = glm::min(minPos, meshCenter - meshRadius);
+            maxPos = glm::max(maxPos, meshCenter + meshRadius);
+        }
+        if(meshes.empty())
+            minPos = maxPos = glm::vec3(getModelMatrix()[3]);
+        center = (minPos + maxPos) * 0.5f;
+        radius = glm::length(maxPos - minPos) * 0.5f;
+    }
+
+    // level of detail of a mesh as seen from lod
+    int selectLod(const Mesh &mesh, const LodContext &lod)
+    {
+        glm::vec3 center;
+        float radius;
+        getMeshBounds(mesh, center, radius);
+        return mesh.selectLod(lod.pixelsPerUnitAt(center, radius, getMaxScale()), lod.maxPixelError());
     }
 
-    // draws the model, and thus all its meshes
-    void Draw(Shader &shader, int textureOffset = 0)
+    // queues all meshes for a pass. without a lod context the full meshes are drawn.
+    void Submit(DrawQueue &queue, const LodContext *lod = nullptr, unsigned int id = 0)
     {
-        // model transformation
-        shader.setMat4("model", getModelMatrix());
+        unsigned int objectIndex = getObjectIndex();
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            queue.add(meshes[i], lod ? selectLod(meshes[i], *lod) : 0, objectIndex, id);
+    }
 
-        // draw each mesh
+    // queues every mesh at a fixed level, levels[i] belongs to meshes[i]. negative levels are skipped.
+    void Submit(DrawQueue &queue, const vector<int> &levels, unsigned int id = 0)
+    {
+        unsigned int objectIndex = getObjectIndex();
         for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader, textureOffset);
+        {
+            int level = i < levels.size() ? levels[i] : 0;
+            if(level >= 0)
+                queue.add(meshes[i], level, objectIndex, id);
+        }
     }
-    
+
 private:
+    ObjectSlot object;
+    MeshOptimizeStats optimizeStats;
+
+    struct LodCacheEntry
+    {
+        uint64_t hash;
+        vector<LodLevel> levels;
+    };
+    vector<LodCacheEntry> lodCache;
+    bool lodCacheDirty = false;
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const &path)
     {
         // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_SortByPType | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
@@ -83,10 +181,16 @@ private:
             return;
         }
         // retrieve the directory path of the filepath
+        this->path = path;
         directory = path.substr(0, path.find_last_of('/'));
 
         // process ASSIMP's root node recursively
+        optimizeStats = MeshOptimizeStats();
+        readLodCache(path + LOD_CACHE_SUFFIX);
         processNode(scene->mRootNode, scene);
+        if(lodCacheDirty)
+            writeLodCache(path + LOD_CACHE_SUFFIX);
+        lodCache.clear();
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -98,6 +202,9 @@ private:
             // the node object only contains indices to index the actual objects in the scene. 
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            // point and line meshes have nothing to draw with triangles
+            if(!(mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE))
+                continue;
             meshes.push_back(processMesh(mesh, scene));
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
@@ -118,7 +225,7 @@ private:
         // walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            Vertex vertex;
+            Vertex vertex = {}; // zero the unused fields, welding compares whole vertices
             glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
             // positions
             vector.x = mesh->mVertices[i].x;
@@ -162,10 +269,33 @@ private:
         for(unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
             aiFace face = mesh->mFaces[i];
+            // points and lines are split into their own meshes by aiProcess_SortByPType, they are not drawn
+            if(face.mNumIndices != 3)
+                continue;
             // retrieve all indices of the face and store them in the indices vector
             for(unsigned int j = 0; j < face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);        
         }
+        // weld duplicates and reorder for the post-transform cache, overdraw and vertex fetch
+        optimizeStats.accumulate(MeshOptimizer::optimize(vertices, indices));
+
+        // simplified levels, from the cache if the mesh did not change
+        vector<LodLevel> lodLevels;
+        size_t meshIndex = meshes.size();
+        uint64_t hash = hashMesh(vertices, indices);
+        if(meshIndex < lodCache.size() && lodCache[meshIndex].hash == hash && validLods(lodCache[meshIndex].levels, vertices.size()))
+        {
+            lodLevels = lodCache[meshIndex].levels;
+        }
+        else
+        {
+            lodLevels = MeshSimplifier::buildLods(vertices, indices);
+            if(lodCache.size() <= meshIndex)
+                lodCache.resize(meshIndex + 1);
+            lodCache[meshIndex] = {hash, lodLevels};
+            lodCacheDirty = true;
+        }
+
         // process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];    
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
@@ -189,7 +319,115 @@ private:
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
         
         // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        return Mesh(vertices, indices, textures, depthStream, lodLevels);
+    }
+
+    static uint64_t hashMesh(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+    {
+        // FNV-1a over positions and indices, enough to notice a changed source file
+        uint64_t h = 14695981039346656037ull;
+        auto mix = [&h](const void *data, size_t size)
+        {
+            const unsigned char *bytes = static_cast<const unsigned char*>(data);
+            for(size_t i = 0; i < size; i++)
+            {
+                h ^= bytes[i];
+                h *= 1099511628211ull;
+            }
+        };
+        for(const Vertex &vertex : vertices)
+            mix(&vertex.Position, sizeof(glm::vec3));
+        mix(indices.data(), indices.size() * sizeof(unsigned int));
+        return h;
+    }
+
+    // cache layout: version, mesh count, then per mesh: hash, level count, per level: error, index count, indices
+    // cached levels must be whole triangles of the mesh they were built for, anything else is rebuilt
+    static bool validLods(const vector<LodLevel> &levels, size_t vertexCount)
+    {
+        for(const LodLevel &level : levels)
+        {
+            if(level.indices.size() % 3 != 0)
+                return false;
+            for(unsigned int index : level.indices)
+                if(index >= vertexCount)
+                    return false;
+        }
+        return true;
+    }
+
+    void readLodCache(const string &cachePath)
+    {
+        lodCache.clear();
+        lodCacheDirty = false;
+        ifstream file(cachePath, ios::binary | ios::ate);
+        if(!file.is_open())
+            return;
+        // counts are checked against the file size, a truncated cache must not allocate huge arrays
+        uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+        file.seekg(0);
+        uint32_t version = 0, meshCount = 0;
+        file.read(reinterpret_cast<char*>(&version), sizeof(version));
+        file.read(reinterpret_cast<char*>(&meshCount), sizeof(meshCount));
+        if(!file || version != LOD_CACHE_VERSION || meshCount > fileSize)
+            return;
+        lodCache.resize(meshCount);
+        for(LodCacheEntry &entry : lodCache)
+        {
+            uint32_t levelCount = 0;
+            file.read(reinterpret_cast<char*>(&entry.hash), sizeof(entry.hash));
+            file.read(reinterpret_cast<char*>(&levelCount), sizeof(levelCount));
+            if(!file || levelCount > fileSize)
+            {
+                file.setstate(ios::failbit);
+                break;
+            }
+            entry.levels.resize(levelCount);
+            for(LodLevel &level : entry.levels)
+            {
+                uint32_t indexCount = 0;
+                file.read(reinterpret_cast<char*>(&level.error), sizeof(level.error));
+                file.read(reinterpret_cast<char*>(&indexCount), sizeof(indexCount));
+                if(!file || static_cast<uint64_t>(indexCount) * sizeof(unsigned int) > fileSize - static_cast<uint64_t>(file.tellg()))
+                {
+                    file.setstate(ios::failbit);
+                    break;
+                }
+                level.indices.resize(indexCount);
+                file.read(reinterpret_cast<char*>(level.indices.data()), indexCount * sizeof(unsigned int));
+            }
+        }
+        if(!file)
+        {
+            cout << "ERROR::MODEL::LOD_CACHE_CORRUPT: " << cachePath << endl;
+            lodCache.clear();
+        }
+    }
+
+    void writeLodCache(const string &cachePath)
+    {
+        ofstream file(cachePath, ios::binary | ios::trunc);
+        if(!file.is_open())
+        {
+            cout << "ERROR::MODEL::LOD_CACHE_NOT_WRITABLE: " << cachePath << endl;
+            return;
+        }
+        uint32_t version = LOD_CACHE_VERSION, meshCount = static_cast<uint32_t>(lodCache.size());
+        file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        file.write(reinterpret_cast<const char*>(&meshCount), sizeof(meshCount));
+        for(const LodCacheEntry &entry : lodCache)
+        {
+            uint32_t levelCount = static_cast<uint32_t>(entry.levels.size());
+            file.write(reinterpret_cast<const char*>(&entry.hash), sizeof(entry.hash));
+            file.write(reinterpret_cast<const char*>(&levelCount), sizeof(levelCount));
+            for(const LodLevel &level : entry.levels)
+            {
+                uint32_t indexCount = static_cast<uint32_t>(level.indices.size());
+                file.write(reinterpret_cast<const char*>(&level.error), sizeof(level.error));
+                file.write(reinterpret_cast<const char*>(&indexCount), sizeof(indexCount));
+                file.write(reinterpret_cast<const char*>(level.indices.data()), indexCount * sizeof(unsigned int));
+            }
+        }
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -248,7 +486,7 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool fli
         else if (nrComponents == 4)
             format = GL_RGBA;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        GLState::instance().bindTexture(0, GL_TEXTURE_2D, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
 
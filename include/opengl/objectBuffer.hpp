@@ -0,0 +1,167 @@
+#ifndef OBJECTBUFFER_H
+#define OBJECTBUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <opengl/glState.hpp>
+#include <opengl/ringBuffer.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// shader storage binding of the per-object data, see drawData.glsl
+#define OBJECT_DATA_BINDING 4
+#define OBJECT_INITIAL_CAPACITY 64
+#define OBJECT_INVALID_INDEX 0xFFFFFFFFu
+
+struct ObjectData
+{
+    glm::mat4 model;
+    // transpose(inverse(model)), only the upper 3x3 is used
+    glm::mat4 normalMatrix;
+};
+
+// transforms of every object, shared by all passes. objects write their matrices only
+// when they change, and flush copies the changed range into the frame's region of the
+// ring buffer once per frame, before the first pass.
+class ObjectBuffer
+{
+public:
+    // created on first use, a GL context must be current by then
+    static ObjectBuffer &instance()
+    {
+        static ObjectBuffer buffer;
+        return buffer;
+    }
+
+    unsigned int allocate()
+    {
+        unsigned int index;
+        if(!freeList.empty())
+        {
+            index = freeList.back();
+            freeList.pop_back();
+        }
+        else
+        {
+            index = static_cast<unsigned int>(objects.size());
+            objects.push_back(ObjectData());
+        }
+        return index;
+    }
+
+    void release(unsigned int index)
+    {
+        freeList.push_back(index);
+    }
+
+    void set(unsigned int index, const glm::mat4 &model, const glm::mat4 &normalMatrix)
+    {
+        objects[index].model = model;
+        objects[index].normalMatrix = normalMatrix;
+        buffer.invalidate(index * sizeof(ObjectData), (index + 1) * sizeof(ObjectData));
+    }
+
+    // copies what changed into the current region. call once per frame after the frame's
+    // transforms are set and before the first pass, transforms set later reach the GPU in
+    // the next frame.
+    void flush()
+    {
+        size_t size = objects.size() * sizeof(ObjectData);
+        // growing rewrites every region
+        if(size > buffer.size())
+            buffer.reserve(std::max(size * 2, OBJECT_INITIAL_CAPACITY * sizeof(ObjectData)));
+        buffer.update(objects.data(), size);
+    }
+
+    // binds the current region as flush left it
+    void bind()
+    {
+        buffer.bindBase(OBJECT_DATA_BINDING);
+    }
+
+private:
+    vector<ObjectData> objects;
+    vector<unsigned int> freeList;
+    RingBuffer buffer = RingBuffer(GL_SHADER_STORAGE_BUFFER);
+
+    ObjectBuffer() {}
+};
+
+// an object's slot in the ObjectBuffer together with its cached matrices.
+// the matrices are only rebuilt when position, scale or rotation changed.
+// copies get a slot of their own, moves take the slot along.
+class ObjectSlot
+{
+public:
+    ObjectSlot() : index(ObjectBuffer::instance().allocate()) {}
+    ObjectSlot(const ObjectSlot &) : ObjectSlot() {}
+    ObjectSlot(ObjectSlot &&other) noexcept
+    {
+        swap(other);
+    }
+    ObjectSlot &operator=(const ObjectSlot &)
+    {
+        // keep our slot, the matrices are rebuilt on the next update
+        valid = false;
+        return *this;
+    }
+    ObjectSlot &operator=(ObjectSlot &&other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+    ~ObjectSlot()
+    {
+        if(index != OBJECT_INVALID_INDEX)
+            ObjectBuffer::instance().release(index);
+    }
+
+    // rebuilds the matrices if the transform changed, model = T * S * R
+    void update(const glm::vec3 &position, const glm::vec3 &scale, const glm::quat &rotation)
+    {
+        if(valid && position == cachedPosition && scale == cachedScale && rotation == cachedRotation)
+            return;
+        cachedPosition = position;
+        cachedScale = scale;
+        cachedRotation = rotation;
+        model = glm::translate(glm::mat4(1.0f), position);
+        model = glm::scale(model, scale);
+        model = model * glm::mat4_cast(rotation);
+        normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(model))));
+        ObjectBuffer::instance().set(index, model, normalMatrix);
+        valid = true;
+    }
+
+    unsigned int getIndex() const { return index; }
+    const glm::mat4 &getModelMatrix() const { return model; }
+    const glm::mat4 &getNormalMatrix() const { return normalMatrix; }
+
+private:
+    unsigned int index = OBJECT_INVALID_INDEX;
+    bool valid = false;
+    glm::vec3 cachedPosition = glm::vec3(0.0f);
+    glm::vec3 cachedScale = glm::vec3(1.0f);
+    glm::quat cachedRotation = glm::quat(1, 0, 0, 0);
+    glm::mat4 model = glm::mat4(1.0f);
+    glm::mat4 normalMatrix = glm::mat4(1.0f);
+
+    void swap(ObjectSlot &other)
+    {
+        std::swap(index, other.index);
+        std::swap(valid, other.valid);
+        std::swap(cachedPosition, other.cachedPosition);
+        std::swap(cachedScale, other.cachedScale);
+        std::swap(cachedRotation, other.cachedRotation);
+        std::swap(model, other.model);
+        std::swap(normalMatrix, other.normalMatrix);
+    }
+};
+
+#endif
@@ -4,6 +4,9 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+#include <string>
 #include <vector>
 
 #include <opengl/model.hpp>
@@ -11,6 +14,11 @@
 #include <opengl/camera.hpp>
 #include <opengl/light.hpp>
 #include <opengl/screenQuad.hpp>
+#include <opengl/lod.hpp>
+#include <opengl/glState.hpp>
+#include <opengl/materialLibrary.hpp>
+#include <opengl/ringBuffer.hpp>
+#include <opengl/shadowAtlas.hpp>
 
 #define MASK_VERTEX_SHADER_PATH "../resources/shaders/mirror_mask.vs"
 #define MASK_FRAGMENT_SHADER_PATH "../resources/shaders/mirror_mask.fs"
@@ -23,6 +31,18 @@
 #define REFLECT_RESOLUTION_X 800
 #define REFLECT_RESOLUTION_Y 600
 #define MAX_REFLECT_PLANE 10
+// how reflections are lit, mirror_reflect is built once per level, see reflectPlane.glsl.
+// full: every light. directional: ambient and the shadowed directional light per pixel.
+// vertex: ambient and the directional light per vertex.
+#define REFLECT_SHADING_FULL 0
+#define REFLECT_SHADING_DIRECTIONAL 1
+#define REFLECT_SHADING_VERTEX 2
+#define REFLECT_SHADING_LEVELS 3
+// picked every frame from the mirror's size on screen and its blur
+#define REFLECT_SHADING_AUTO -1
+// the mirror's radius in pixels, halved per blur level, from which a level is picked
+#define REFLECT_SHADING_FULL_PIXELS 96.0f
+#define REFLECT_SHADING_DIRECTIONAL_PIXELS 24.0f
 #define PI 3.14159265359
 
 class ReflectPlane
@@ -32,6 +52,8 @@ public:
     glm::vec3 color = glm::vec3(1.0f);
     float reflectRate = 1.0f;
     float blurLevel = 0;
+    // a REFLECT_SHADING level, or REFLECT_SHADING_AUTO
+    int shading = REFLECT_SHADING_AUTO;
     
     ReflectPlane(string const &path, glm::vec3 normal, bool flip = true) : model(path, flip), baseNormal(glm::normalize(normal)) {}
     ReflectPlane(string const &path, bool flip = true) : model(path, flip)
@@ -47,14 +69,14 @@ public:
 
     glm::vec3 getNormal()
     {
-        glm::mat4 modelMatrix = model.getModelMatrix();
-        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
-        return glm::normalize(normalMatrix * baseNormal);
+        // the normal matrix is cached with the model's transform
+        return glm::normalize(glm::mat3(model.getNormalMatrix()) * baseNormal);
     }
 
-    void Draw(Shader &shader, int textureOffset = 0)
+    // queues the plane's meshes, id is the plane index read by the mirror shaders
+    void Submit(DrawQueue &queue, unsigned int id)
     {
-        model.Draw(shader, textureOffset);
+        model.Submit(queue, nullptr, id);
     }
 
 private:
@@ -64,23 +86,28 @@ private:
 class ReflectPlaneManager
 {
 public:
-    ReflectPlaneManager() : maskShader(Shader(MASK_VERTEX_SHADER_PATH, MASK_FRAGMENT_SHADER_PATH)),
-                            reflectShader(Shader(REFLECT_VERTEX_SHADER_PATH, REFLECT_FRAGMENT_SHADER_PATH, REFLECT_GEOMETRY_SHADER_PATH)),
+    // lod bias of the reflection pass, reflected geometry is allowed a larger pixel error
+    float reflectLodBias = 2.0f;
+
+    // the programs are built deferred, the passes are skipped until they are ready
+    ReflectPlaneManager() : maskShader(Shader(MASK_VERTEX_SHADER_PATH, MASK_FRAGMENT_SHADER_PATH, nullptr, ShaderDefines(), true)),
+                            reflectShaders(REFLECT_VERTEX_SHADER_PATH, REFLECT_FRAGMENT_SHADER_PATH, REFLECT_GEOMETRY_SHADER_PATH),
                             // reflectShader(Shader("../resources/shaders/model_lighting.vs", "../resources/shaders/model_lighting.fs")),
-                            debugShader(Shader("../resources/shaders/screen_quad.vs", "../resources/shaders/screen_quad.fs"))
+                            debugShader(Shader("../resources/shaders/screen_quad.vs", "../resources/shaders/screen_quad.fs", nullptr, ShaderDefines(), true))
     {
+        GLState &state = GLState::instance();
         // init framebuffer
         glGenFramebuffers(1, &framebuffer);
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        state.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
 
         glGenTextures(1, &texMask);
-        glBindTexture(GL_TEXTURE_2D, texMask);
+        state.bindTexture(0, GL_TEXTURE_2D, texMask);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, MASK_RESOLUTION_X, MASK_RESOLUTION_Y, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
         glGenTextures(1, &texReflect);
-        glBindTexture(GL_TEXTURE_2D, texReflect);
+        state.bindTexture(0, GL_TEXTURE_2D, texReflect);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, REFLECT_RESOLUTION_X, REFLECT_RESOLUTION_Y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -92,14 +119,11 @@ public:
         glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
 
         glBindRenderbuffer(GL_RENDERBUFFER, 0);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        state.bindFramebuffer(GL_FRAMEBUFFER, 0);
 
-        //init data buffer
-        glGenBuffers(1, &planeDataBuffer);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, planeDataBuffer);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, MAX_REFLECT_PLANE * sizeof(PlaneData), NULL, GL_STATIC_DRAW);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); 
+        //init data buffer, rewritten every frame
+        planeDataBuffer.reserve(MAX_REFLECT_PLANE * sizeof(PlaneData));
+        planeData.reserve(MAX_REFLECT_PLANE);
     }
 
     void addReflectPlane(ReflectPlane reflectPlane)
@@ -108,7 +132,9 @@ public:
         {
             return;
         }       
-        reflectPlanes.push_back(reflectPlane);
+        reflectPlanes.push_back(std::move(reflectPlane));
+        blurDefined = anyBlur();
+        definesVersion++;
     }
 
     void removeReflectPlane(int index)
@@ -116,38 +142,110 @@ public:
         if (index < reflectPlanes.size())
         {
             reflectPlanes.erase(reflectPlanes.begin() + index);
+            blurDefined = anyBlur();
+            definesVersion++;
         }
     }
 
     void clear()
     {
         reflectPlanes.clear();
+        blurDefined = false;
+        definesVersion++;
+    }
+
+    // bumped when the planes are added or removed, or updatePlanes finds blur turned on
+    // or off. programs built with getShaderDefines compare it to reselect theirs.
+    unsigned long getDefinesVersion() const
+    {
+        return definesVersion;
+    }
+
+    // defines specializing reflectPlane.glsl and mirror.fs for the current planes
+    ShaderDefines getShaderDefines() const
+    {
+        ShaderDefines defines;
+        bool blur = anyBlur();
+        // an empty array can not be sized, no planes keeps the runtime count
+        if(!reflectPlanes.empty())
+            defines["REFLECT_PLANE_COUNT"] = std::to_string(reflectPlanes.size());
+        defines["MIRROR_BLUR"] = blur ? "1" : "0";
+        return defines;
+    }
+
+    // submits the reflection programs for the current lights and planes ahead of the first frame
+    void prepareShaders(LightManager &lightManager)
+    {
+        for(int level = 0; level < REFLECT_SHADING_LEVELS; level++)
+            selectReflectShader(lightManager, level);
+    }
+
+    unsigned int getPlaneCount() const
+    {
+        return static_cast<unsigned int>(reflectPlanes.size());
+    }
+
+    // writes and binds this frame's plane data with the shading level of each mirror and
+    // updates the mirrors' transforms. call once per frame before ObjectBuffer::flush.
+    void updatePlanes(Camera &camera)
+    {
+        planeData.clear();
+        shadingLevels = 0;
+        for (int i = 0; i < reflectPlanes.size(); i++)
+        {
+            reflectPlanes[i].model.updateTransform();
+            PlaneData data;
+            data.position = glm::vec4(reflectPlanes[i].model.position, 1.0f);
+            data.normal = glm::vec4(reflectPlanes[i].getNormal(), 0.0f);
+            data.color = glm::vec4(reflectPlanes[i].color, 1.0f);
+            data.reflectRate = reflectPlanes[i].reflectRate;
+            data.blurLevel = reflectPlanes[i].blurLevel;
+            data.shading = selectShading(camera, reflectPlanes[i]);
+            shadingLevels |= 1u << data.shading;
+            planeData.push_back(data);
+        }
+        bool blur = anyBlur();
+        if(blur != blurDefined)
+        {
+            blurDefined = blur;
+            definesVersion++;
+        }
+        planeDataBuffer.write(planeData.data(), planeData.size() * sizeof(PlaneData));
+        planeDataBuffer.bindBase(2);
     }
 
     void generateReflection(Camera& camera, LightManager& lightManager, vector<Model>& models)
     {
+        // keep the last reflection while a program is still compiling. all are polled, so
+        // they finish without blocking
+        bool ready = maskShader.isReady();
+        Shader *shaders[REFLECT_SHADING_LEVELS] = {};
+        for(int level = 0; level < REFLECT_SHADING_LEVELS; level++)
+        {
+            if(!(shadingLevels & (1u << level)))
+                continue;
+            shaders[level] = &selectReflectShader(lightManager, level);
+            ready &= shaders[level]->isReady();
+        }
+        if(!ready)
+            return;
+        // camera and lights come from the frame constants
         maskShader.use();
-        maskShader.setCamera(camera);
         DrawMask();
         // DebugMask(texMask);
-        reflectShader.use();
-        reflectShader.setCamera(camera);
-        lightManager.Attach(reflectShader);
-        DrawReflect(models);
+        lightManager.Attach();
+        DrawReflect(shaders, camera, models);
         // DebugMask(texReflect);
     }
 
-    void Draw(Shader &shader, int textureOffset = 0)
+    void Draw(Shader &shader)
     {
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, planeDataBuffer);
-        glActiveTexture(GL_TEXTURE0 + textureOffset);
-        glBindTexture(GL_TEXTURE_2D, texReflect);
-        shader.setInt("texture_reflect", textureOffset);
+        planeDataBuffer.bindBase(2);
+        shader.bindTexture("texture_reflect", GL_TEXTURE_2D, texReflect);
+        planeQueue.clear();
         for (int i = 0; i < reflectPlanes.size(); i++)
-        {
-            shader.setUint("planeId", i);
-            reflectPlanes[i].Draw(shader, textureOffset + 1);
-        }
+            reflectPlanes[i].Submit(planeQueue, i);
+        planeQueue.Draw(shader);
     }
 
 private:
@@ -158,86 +256,185 @@ private:
         glm::vec4 color;
         float reflectRate;
         float blurLevel;
+        int shading;
     };
     vector<ReflectPlane> reflectPlanes;
     vector<PlaneData> planeData;
-    Shader maskShader, reflectShader;
+    vector<int> reflectLevels[REFLECT_SHADING_LEVELS];
+    // one queue per pass and per shading level of the reflection pass, their buffers are
+    // rewritten every frame
+    DrawQueue maskQueue, planeQueue;
+    DrawQueue reflectQueues[REFLECT_SHADING_LEVELS];
+    Shader maskShader;
+    // mirror_reflect specialized for the light and plane defines and the shading level, the
+    // current one of each level is cached with the defines versions it was chosen for
+    ShaderPermutations reflectShaders;
+    Shader *reflectShader[REFLECT_SHADING_LEVELS] = {};
+    unsigned long reflectShaderVersions[REFLECT_SHADING_LEVELS][2] = {};
+    // bit per shading level used by a mirror this frame
+    unsigned int shadingLevels = 0;
+    unsigned long definesVersion = 0;
+    // whether a plane blurs, as of the last definesVersion
+    bool blurDefined = false;
     Shader debugShader;
-    GLuint framebuffer, planeDataBuffer;
+    GLuint framebuffer;
+    RingBuffer planeDataBuffer = RingBuffer(GL_SHADER_STORAGE_BUFFER);
     GLuint texMask, texReflect;
     // debug
     ScreenQuad debugQuad;
 
     void DrawMask()
     {
+        GLState &state = GLState::instance();
         // disable blend when rendering mask
-        glDisable(GL_BLEND);
+        state.setEnabled(GL_BLEND, false);
 
         // set framebuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        state.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
         glClear(GL_DEPTH_BUFFER_BIT);
         glClearTexImage(texMask, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texMask, 0);
         
-        // render mask
+        // render mask, positions only. the mask id is the draw's id
+        maskQueue.clear();
         for(int i = 0; i < reflectPlanes.size(); i++)
+            reflectPlanes[i].Submit(maskQueue, i);
+        maskQueue.Draw(maskShader, true);
+        // the framebuffer stays bound for DrawReflect, which unbinds it
+
+        state.setEnabled(GL_BLEND, true);
+    }
+
+    // one level per mesh and shading level, for all mirrors of that shading level at once:
+    // the finest level any of them needs. each mirror sees the mesh from the reflected
+    // camera, and its blur widens the allowed error since the reflection is sampled at mip
+    // blurLevel. meshes no mirror of a shading level can see get -1 there, so each shading
+    // level's queue only holds what its mirrors reflect.
+    void selectReflectLods(Camera &camera, Model &model, vector<int> (&levels)[REFLECT_SHADING_LEVELS])
+    {
+        LodContext baseLod = LodContext::fromCamera(camera);
+        for(int shading = 0; shading < REFLECT_SHADING_LEVELS; shading++)
+            levels[shading].assign(model.meshes.size(), -1);
+        for(unsigned int m = 0; m < model.meshes.size(); m++)
         {
-            maskShader.setUint("maskId", i);
-            reflectPlanes[i].Draw(maskShader);
+            glm::vec3 center;
+            float radius;
+            model.getMeshBounds(model.meshes[m], center, radius);
+            for(size_t i = 0; i < planeData.size(); i++)
+            {
+                glm::vec3 planePos = glm::vec3(planeData[i].position);
+                glm::vec3 normal = glm::vec3(planeData[i].normal);
+                float cameraSide = dot(camera.Position - planePos, normal);
+                // same rejections as mirror_reflect.gs: mirror facing away, mesh behind the mirror
+                if(cameraSide < 0 || dot(center - planePos, normal) < -radius)
+                    continue;
+                int &selected = levels[planeData[i].shading][m];
+                if(selected == 0)
+                    continue;
+                LodContext lod = baseLod;
+                lod.viewPos = camera.Position - 2.0f * cameraSide * normal;
+                lod.bias = reflectLodBias * glm::exp2(planeData[i].blurLevel);
+                int level = model.selectLod(model.meshes[m], lod);
+                if(selected < 0 || level < selected)
+                    selected = level;
+            }
         }
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // whether any mirror blurs its reflection, which decides the blur define
+    bool anyBlur() const
+    {
+        for(const ReflectPlane &plane : reflectPlanes)
+            if(plane.blurLevel > 0.0f)
+                return true;
+        return false;
+    }
+
+    // the level of a mirror: blur and distance shrink the detail of its reflection, and
+    // with it the lighting worth computing
+    int selectShading(Camera &camera, ReflectPlane &plane)
+    {
+        if(plane.shading != REFLECT_SHADING_AUTO)
+            return glm::clamp(plane.shading, 0, REFLECT_SHADING_LEVELS - 1);
+        glm::vec3 center;
+        float radius;
+        plane.model.getBounds(center, radius);
+        float distance = glm::length(center - camera.Position);
+        if(distance <= radius)
+            return REFLECT_SHADING_FULL;
+        float pixels = radius / (distance * std::tan(glm::radians(camera.Zoom) * 0.5f)) * camera.resolution.y * 0.5f;
+        pixels *= glm::exp2(-plane.blurLevel);
+        if(pixels >= REFLECT_SHADING_FULL_PIXELS)
+            return REFLECT_SHADING_FULL;
+        return pixels >= REFLECT_SHADING_DIRECTIONAL_PIXELS ? REFLECT_SHADING_DIRECTIONAL : REFLECT_SHADING_VERTEX;
+    }
 
-        glEnable(GL_BLEND);
+    // the permutation for the current light and plane defines, chosen again whenever either
+    // defines version moved since it was chosen
+    Shader &selectReflectShader(LightManager &lightManager, int level)
+    {
+        unsigned long versions[2] = {lightManager.getDefinesVersion(), definesVersion};
+        if(reflectShader[level] == nullptr || !std::equal(versions, versions + 2, reflectShaderVersions[level]))
+        {
+            ShaderDefines defines = lightManager.getShaderDefines();
+            ShaderDefines materialDefines = MaterialLibrary::instance().getShaderDefines();
+            defines.insert(materialDefines.begin(), materialDefines.end());
+            if(!reflectPlanes.empty())
+                defines["REFLECT_PLANE_COUNT"] = std::to_string(reflectPlanes.size());
+            defines["REFLECT_SHADING"] = std::to_string(level);
+            reflectShader[level] = &reflectShaders.get(defines, true);
+            std::copy(versions, versions + 2, reflectShaderVersions[level]);
+        }
+        return *reflectShader[level];
     }
 
-    void DrawReflect(vector<Model>& models)
+    // draws the reflected models of each shading level in use, each level only into its mirrors
+    void DrawReflect(Shader *shaders[REFLECT_SHADING_LEVELS], Camera &camera, vector<Model>& models)
     {
+        GLState &state = GLState::instance();
         // set framebuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        state.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
         glClear(GL_DEPTH_BUFFER_BIT);
         glClearTexImage(texReflect, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texReflect, 0);
 
-        // generate reflect plane data
-        planeData.clear();
-        for (int i = 0; i < reflectPlanes.size(); i++)
+        // plane data written by updatePlanes
+        planeDataBuffer.bindBase(2);
+
+        // render reflection, a mesh goes to the queue of every shading level whose mirrors
+        // reflect it, so each mirror's geometry is drawn once
+        for(DrawQueue &queue : reflectQueues)
+            queue.clear();
+        for(int i = 0; i < models.size(); i++)
         {
-            PlaneData data;
-            data.position = glm::vec4(reflectPlanes[i].model.position, 1.0f);
-            data.normal = glm::vec4(reflectPlanes[i].getNormal(), 0.0f);
-            data.color = glm::vec4(reflectPlanes[i].color, 1.0f);
-            data.reflectRate = reflectPlanes[i].reflectRate;
-            data.blurLevel = reflectPlanes[i].blurLevel;
-            planeData.push_back(data);
+            selectReflectLods(camera, models[i], reflectLevels);
+            for(int level = 0; level < REFLECT_SHADING_LEVELS; level++)
+                if(shaders[level] != nullptr)
+                    models[i].Submit(reflectQueues[level], reflectLevels[level]);
         }
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, planeDataBuffer);
-        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, planeData.size() * sizeof(PlaneData), planeData.data());
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, planeDataBuffer);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-        // set uniforms    
-        reflectShader.setUint("GL_Num_ReflectPlane", reflectPlanes.size());
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texMask);
-        reflectShader.setInt("texture_mask", 0);
-
-        // render reflection
-        for(int i = 0; i < models.size(); i++)
+        for(int level = 0; level < REFLECT_SHADING_LEVELS; level++)
         {
-            models[i].Draw(reflectShader, 1);// texture unit 0 is for mask
+            if(shaders[level] == nullptr || reflectQueues[level].empty())
+                continue;
+            Shader &reflectShader = *shaders[level];
+            reflectShader.use();
+            ShadowAtlas::bind(reflectShader);
+            reflectShader.setUint("GL_Num_ReflectPlane", reflectPlanes.size());
+            reflectShader.bindTexture("texture_mask", GL_TEXTURE_2D, texMask);
+            reflectQueues[level].Draw(reflectShader);
         }
 
         // generate mipmap for texReflect
-        glBindTexture(GL_TEXTURE_2D, texReflect);
+        state.bindTexture(0, GL_TEXTURE_2D, texReflect);
         glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, 0);
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        state.bindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
     void DebugMask(GLuint texture)
     {
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        GLState::instance().bindFramebuffer(GL_FRAMEBUFFER, 0);
+        debugShader.finish();
         debugShader.use();
         debugQuad.setTexture(texture);
         debugQuad.Draw(debugShader);
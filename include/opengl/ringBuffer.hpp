@@ -0,0 +1,173 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <glad/glad.h>
+
+#include <opengl/glState.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// copies of the per-frame data in flight: the CPU writes one region while the GPU may
+// still read the regions of the two frames before
+#define RING_BUFFER_REGIONS 3
+
+// fences the commands of every frame. a frame writes the ring buffer regions of the frame
+// RING_BUFFER_REGIONS before it, beginFrame waits until the GPU is done with that frame.
+class FrameSync
+{
+public:
+    // frames in which the CPU had to wait for the GPU
+    static unsigned long stalls;
+
+    // frames begun so far
+    static unsigned long long currentFrame()
+    {
+        return frame;
+    }
+
+    // region of the ring buffers the current frame writes and binds
+    static unsigned int region()
+    {
+        return static_cast<unsigned int>(frame % RING_BUFFER_REGIONS);
+    }
+
+    // call before anything is written to a ring buffer in this frame
+    static void beginFrame()
+    {
+        GLsync &fence = fences[region()];
+        if(fence == nullptr)
+            return;
+        if(glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            stalls++;
+            while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull) == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    // call after the last command of the frame that reads a ring buffer
+    static void endFrame()
+    {
+        fences[region()] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        frame++;
+    }
+
+private:
+    static unsigned long long frame;
+    static GLsync fences[RING_BUFFER_REGIONS];
+};
+
+// a buffer holding RING_BUFFER_REGIONS copies of its contents in persistently mapped,
+// coherent storage. each frame writes and binds the region of FrameSync::region(), so an
+// upload is a memcpy and the driver never has to wait for the GPU or rename the buffer.
+// contents that change rarely are tracked per region and copied into a region the next
+// time it is current.
+class RingBuffer
+{
+public:
+    RingBuffer(GLenum target) : target(target) {}
+
+    // grows every region to at least size bytes. storage is immutable, so growing creates
+    // a new buffer whose regions all have to be rewritten. true if it grew.
+    bool reserve(size_t size)
+    {
+        if(buffer != 0 && size <= regionSize)
+            return false;
+        GLint alignment = 1;
+        glGetIntegerv(target == GL_UNIFORM_BUFFER ? GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT : GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        size = std::max(size, static_cast<size_t>(1));
+        regionSize = (size + alignment - 1) / alignment * alignment;
+        if(buffer != 0)
+        {
+            glUnmapNamedBuffer(buffer);
+            GLState::instance().deleteBuffer(buffer);
+        }
+
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glCreateBuffers(1, &buffer);
+        glNamedBufferStorage(buffer, regionSize * RING_BUFFER_REGIONS, NULL, flags);
+        mapped = static_cast<char*>(glMapNamedBufferRange(buffer, 0, regionSize * RING_BUFFER_REGIONS, flags));
+        invalidate(0, regionSize);
+        // nothing reads the new buffer yet, so this frame may update it again
+        updatedFrame = NO_FRAME;
+        return true;
+    }
+
+    size_t size() const
+    {
+        return regionSize;
+    }
+
+    // the current frame's region
+    char *data()
+    {
+        return mapped + offset();
+    }
+
+    GLintptr offset() const
+    {
+        return static_cast<GLintptr>(FrameSync::region() * regionSize);
+    }
+
+    void write(const void *contents, size_t size, size_t at = 0)
+    {
+        memcpy(data() + at, contents, size);
+    }
+
+    // marks bytes [begin, end) as changed, each region receives them when it is next updated
+    void invalidate(size_t begin, size_t end)
+    {
+        for(Range &range : dirty)
+        {
+            range.begin = std::min(range.begin, begin);
+            range.end = std::max(range.end, end);
+        }
+    }
+
+    // copies what changed since this region was last current from contents, the CPU copy of
+    // the whole buffer, which is size bytes long. once per frame: passes submitted after the
+    // first update read the region, so later calls in the frame do nothing and their changes
+    // reach the region the next time it is current.
+    void update(const void *contents, size_t size)
+    {
+        if(updatedFrame == FrameSync::currentFrame())
+            return;
+        updatedFrame = FrameSync::currentFrame();
+        Range &range = dirty[FrameSync::region()];
+        size_t end = std::min(range.end, size);
+        if(range.begin < end)
+            memcpy(data() + range.begin, static_cast<const char*>(contents) + range.begin, end - range.begin);
+        range = Range();
+    }
+
+    // binds the current region
+    void bindBase(GLuint index)
+    {
+        GLState::instance().bindBufferRange(target, index, buffer, offset(), regionSize);
+    }
+
+private:
+    struct Range
+    {
+        size_t begin = SIZE_MAX;
+        size_t end = 0;
+    };
+
+    static const unsigned long long NO_FRAME = ~0ull;
+
+    GLenum target;
+    GLuint buffer = 0;
+    char *mapped = nullptr;
+    size_t regionSize = 0;
+    Range dirty[RING_BUFFER_REGIONS];
+    unsigned long long updatedFrame = NO_FRAME;
+};
+
+unsigned long FrameSync::stalls = 0;
+unsigned long long FrameSync::frame = 0;
+GLsync FrameSync::fences[RING_BUFFER_REGIONS] = {};
+
+#endif
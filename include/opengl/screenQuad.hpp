@@ -7,6 +7,7 @@
 #include <vector>
 
 #include <opengl/shader.hpp>
+#include <opengl/glState.hpp>
 
 class ScreenQuad
 {
@@ -15,8 +16,9 @@ public:
     {
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        GLState &state = GLState::instance();
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, VBO);
         float vertices[] = {
             -1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
             1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
@@ -32,9 +34,9 @@ public:
         // texture coord attribute
         glEnableVertexAttribArray(1);
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-        glBindVertexArray(0);
     }
 
+    // the texture is validated here once, Draw only checks that one was set
     void setTexture(GLuint tex)
     {
         if(glIsTexture(tex))
@@ -45,23 +47,25 @@ public:
 
     void Draw(Shader &shader)
     {
-        if(!glIsTexture(texture))
+        if(texture == 0)
         {
             std::cout << "ERROR::SCREENQUAD::NO_TEXTURE" << std::endl;
             return;
         }
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        shader.setUint("Texture", 0);
-        glBindVertexArray(VAO);
+        shader.bindTexture("Texture", GL_TEXTURE_2D, texture);
+        DrawFullscreen();
+    }
+
+    // draws the quad with the textures the shader bound itself
+    void DrawFullscreen()
+    {
+        GLState::instance().bindVertexArray(VAO);
         glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
-        glBindTexture(GL_TEXTURE_2D, 0);
     }
 
 private:
     GLuint VAO, VBO;
-    GLuint texture;
+    GLuint texture = 0;
     std::vector<glm::vec3> vertices;
 };
 
@@ -9,182 +9,277 @@
 #include <sstream>
 #include <iostream>
 #include <unordered_map>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <vector>
 
 #include <opengl/camera.hpp>
+#include <opengl/shaderPreprocessor.hpp>
+#include <opengl/glExtensions.hpp>
+#include <opengl/glState.hpp>
+#include <opengl/material.hpp>
+
+// linked program binaries are stored here, relative to the working directory
+#define SHADER_CACHE_DIR "shader_cache/"
+#define SHADER_CACHE_MAGIC 0x50524F47u
+#define SHADER_CACHE_VERSION 1
+
+// a uniform location resolved once, typed by the value it takes
+template<typename T>
+struct Uniform
+{
+    GLint location = -1;
+};
 
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
-    // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
-    {
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::string geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-            // if geometry shader path is present, also load a geometry shader
-            if(geometryPath != nullptr)
-            {
-                gShaderFile.open(geometryPath);
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-                geometryCode = gShaderStream.str();
-            }
-        }
-        catch (std::ifstream::failure& e)
-        {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
-        }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        includeShaders(vertexPath, vertexCode);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        includeShaders(fragmentPath, fragmentCode);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // if geometry shader is given, compile geometry shader
-        unsigned int geometry;
-        if(geometryPath != nullptr)
-        {
-            const char * gShaderCode = geometryCode.c_str();
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gShaderCode, NULL);
-            includeShaders(geometryPath, geometryCode);
-            glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
-        }
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        if(geometryPath != nullptr)
-            glAttachShader(ID, geometry);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if(geometryPath != nullptr)
-            glDeleteShader(geometry);
 
+    // glGetUniformLocation calls made by all shaders, only name cache misses query GL.
+    // after the first frame this should stay constant.
+    static unsigned long locationQueries;
+
+    // startup statistics of all shaders: programs taken from the binary cache,
+    // programs compiled from source and programs still compiling
+    static unsigned int cachedPrograms;
+    static unsigned int compiledPrograms;
+    static unsigned int pendingPrograms;
+    // print how long every program took to link or load from the cache
+    static bool verbose;
+
+    // locations of the uniforms the engine sets on every program
+    Uniform<glm::mat4> projectionUniform;
+    Uniform<glm::mat4> viewUniform;
+    Uniform<glm::vec3> cameraPosUniform;
+    Uniform<glm::vec2> screenResolutionUniform;
+    Uniform<unsigned int> drawOffsetUniform;
+
+    // constructor generates the shader on the fly, specialized with the given defines.
+    // a deferred shader only submits its stages: the driver may compile them while other
+    // work goes on, and the program is finished by the first isReady() that finds it
+    // complete. until then it must not be used.
+    // ------------------------------------------------------------------------
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
+           const ShaderDefines &defines = ShaderDefines(), bool deferred = false)
+    {
+        name = std::string(vertexPath) + " " + fragmentPath + (geometryPath != nullptr ? std::string(" ") + geometryPath : std::string());
+        stageTypes[0] = GL_VERTEX_SHADER;
+        stageTypes[1] = GL_FRAGMENT_SHADER;
+        stageTypes[2] = GL_GEOMETRY_SHADER;
+        const char *paths[3] = {vertexPath, fragmentPath, geometryPath};
+        build(paths, defines, deferred);
+    }
+    // compute program, see Shader above for defines and deferred
+    explicit Shader(const char* computePath, const ShaderDefines &defines = ShaderDefines(), bool deferred = false)
+    {
+        name = computePath;
+        stageTypes[0] = GL_COMPUTE_SHADER;
+        const char *paths[3] = {computePath, nullptr, nullptr};
+        build(paths, defines, deferred);
+    }
+    // true once the program is linked. never blocks when the driver supports
+    // GL_KHR_parallel_shader_compile, otherwise finishes the program right away.
+    bool isReady()
+    {
+        if(ready)
+            return true;
+        if(GLExtensions::parallelShaderCompile)
+        {
+            GLint complete = GL_FALSE;
+            glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &complete);
+            if(!complete)
+                return false;
+        }
+        finishProgram(false);
+        return true;
+    }
+    // blocks until the program is linked
+    void finish()
+    {
+        if(!ready)
+            finishProgram(false);
     }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() 
     { 
-        glUseProgram(ID); 
+        GLState::instance().useProgram(ID);
     }
+    // only needed by programs that do not include frame.glsl, the others read the
+    // camera from the frame constants
     void setCamera(Camera &camera)
     {
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), camera.aspect, camera.near, camera.far);
         glm::mat4 view = camera.GetViewMatrix();
-        setMat4("projection", projection);
-        setMat4("view", view);
-        setVec3("cameraPos", camera.Position);
-        setVec2("screenResolution", camera.resolution);
+        set(projectionUniform, projection);
+        set(viewUniform, view);
+        set(cameraPosUniform, camera.Position);
+        set(screenResolutionUniform, camera.resolution);
+    }
+    // location of a uniform by name. active uniforms are known after linking, other names
+    // are queried once and cached. no std::string is built for the lookup.
+    GLint getLocation(const char *name) const
+    {
+        uint64_t hash = hashName(name);
+        auto it = uniformLocations.find(hash);
+        if(it != uniformLocations.end() && it->second.name == name)
+            return it->second.location;
+        GLint location = glGetUniformLocation(ID, name);
+        locationQueries++;
+        uniformLocations[hash] = {name, location};
+        return location;
     }
+    template<typename T>
+    Uniform<T> getUniform(const char *name) const
+    {
+        Uniform<T> uniform;
+        uniform.location = getLocation(name);
+        return uniform;
+    }
+    // textures
+    // ------------------------------------------------------------------------
+    // true if the program fetches material textures by index, see MaterialLibrary
+    bool usesMaterialTable() const
+    {
+        return materialTable;
+    }
+    // false for programs without active samplers, their draws need no material bound
+    bool usesSamplers() const
+    {
+        return !samplerUnits.empty();
+    }
+    // every active sampler is given its own unit after linking, -1 if the program has no such sampler
+    GLint getTextureUnit(const char *sampler) const
+    {
+        auto it = samplerUnits.find(hashName(sampler));
+        if(it != samplerUnits.end() && it->second.name == sampler)
+            return it->second.location;
+        return -1;
+    }
+    // binds a texture to the unit of a sampler, nothing if the program does not read it
+    void bindTexture(const char *sampler, GLenum target, GLuint texture) const
+    {
+        GLint unit = getTextureUnit(sampler);
+        if(unit >= 0)
+            GLState::instance().bindTexture(unit, target, texture);
+    }
+    // binds the textures of a material. the units are looked up once per material and
+    // program, textures already bound on their unit are skipped by the state cache.
+    void bindMaterial(const Material &material) const
+    {
+        auto it = materialBindings.find(material.id);
+        if(it == materialBindings.end())
+        {
+            std::vector<TextureBinding> &bindings = materialBindings[material.id];
+            for(const MaterialTexture &texture : material.textures)
+            {
+                GLint unit = getTextureUnit(texture.sampler.c_str());
+                if(unit >= 0)
+                    bindings.push_back({static_cast<GLuint>(unit), texture.target, texture.texture});
+            }
+            it = materialBindings.find(material.id);
+        }
+        GLState &state = GLState::instance();
+        for(const TextureBinding &binding : it->second)
+            state.bindTexture(binding.unit, binding.target, binding.texture);
+    }
+    // typed uniform functions
+    // ------------------------------------------------------------------------
+    void set(Uniform<bool> uniform, bool value) const { glUniform1i(uniform.location, (int)value); }
+    void set(Uniform<int> uniform, int value) const { glUniform1i(uniform.location, value); }
+    void set(Uniform<unsigned int> uniform, unsigned int value) const { glUniform1ui(uniform.location, value); }
+    void set(Uniform<float> uniform, float value) const { glUniform1f(uniform.location, value); }
+    void set(Uniform<glm::vec2> uniform, const glm::vec2 &value) const { glUniform2fv(uniform.location, 1, &value[0]); }
+    void set(Uniform<glm::vec3> uniform, const glm::vec3 &value) const { glUniform3fv(uniform.location, 1, &value[0]); }
+    void set(Uniform<glm::vec4> uniform, const glm::vec4 &value) const { glUniform4fv(uniform.location, 1, &value[0]); }
+    void set(Uniform<glm::mat3> uniform, const glm::mat3 &mat) const { glUniformMatrix3fv(uniform.location, 1, GL_FALSE, &mat[0][0]); }
+    void set(Uniform<glm::mat4> uniform, const glm::mat4 &mat) const { glUniformMatrix4fv(uniform.location, 1, GL_FALSE, &mat[0][0]); }
     // utility uniform functions
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(const char *name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        glUniform1i(getLocation(name), (int)value); 
     }
+    void setBool(const std::string &name, bool value) const { setBool(name.c_str(), value); }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(const char *name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1i(getLocation(name), value); 
     }
+    void setInt(const std::string &name, int value) const { setInt(name.c_str(), value); }
     // ------------------------------------------------------------------------
-    void setUint(const std::string &name, int value) const
+    void setUint(const char *name, int value) const
     { 
-        glUniform1ui(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1ui(getLocation(name), value); 
     }
+    void setUint(const std::string &name, int value) const { setUint(name.c_str(), value); }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(const char *name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1f(getLocation(name), value); 
     }
+    void setFloat(const std::string &name, float value) const { setFloat(name.c_str(), value); }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(const char *name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform2fv(getLocation(name), 1, &value[0]); 
     }
-    void setVec2(const std::string &name, float x, float y) const
+    void setVec2(const char *name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(getLocation(name), x, y); 
     }
+    void setVec2(const std::string &name, const glm::vec2 &value) const { setVec2(name.c_str(), value); }
+    void setVec2(const std::string &name, float x, float y) const { setVec2(name.c_str(), x, y); }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(const char *name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform3fv(getLocation(name), 1, &value[0]); 
     }
-    void setVec3(const std::string &name, float x, float y, float z) const
+    void setVec3(const char *name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(getLocation(name), x, y, z); 
     }
+    void setVec3(const std::string &name, const glm::vec3 &value) const { setVec3(name.c_str(), value); }
+    void setVec3(const std::string &name, float x, float y, float z) const { setVec3(name.c_str(), x, y, z); }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(const char *name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform4fv(getLocation(name), 1, &value[0]); 
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w) 
+    void setVec4(const char *name, float x, float y, float z, float w) const
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(getLocation(name), x, y, z, w); 
     }
+    void setVec4(const std::string &name, const glm::vec4 &value) const { setVec4(name.c_str(), value); }
+    void setVec4(const std::string &name, float x, float y, float z, float w) const { setVec4(name.c_str(), x, y, z, w); }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat2(const char *name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(getLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
+    void setMat2(const std::string &name, const glm::mat2 &mat) const { setMat2(name.c_str(), mat); }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat3(const char *name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(getLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
+    void setMat3(const std::string &name, const glm::mat3 &mat) const { setMat3(name.c_str(), mat); }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    void setMat4(const char *name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(getLocation(name), 1, GL_FALSE, &mat[0][0]);
     }
+    void setMat4(const std::string &name, const glm::mat4 &mat) const { setMat4(name.c_str(), mat); }
 
 private:
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    void checkCompileErrors(GLuint shader, std::string type, const ShaderSource *source = nullptr)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -194,7 +289,12 @@ private:
             if(!success)
             {
                 glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+                std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog;
+                // error locations are (source string, line), name the files
+                if(source != nullptr)
+                    for(size_t i = 0; i < source->files.size(); i++)
+                        std::cout << "source " << i << ": " << source->files[i] << "\n";
+                std::cout << " -- --------------------------------------------------- -- " << std::endl;
             }
         }
         else
@@ -208,43 +308,345 @@ private:
         }
     }
 
-    static std::unordered_map<std::string, std::string> shaderIncludes;
+    void build(const char *paths[3], const ShaderDefines &defines, bool deferred)
+    {
+        startTime = std::chrono::steady_clock::now();
+        std::string definesText = ShaderPreprocessor::definesKey(defines);
+        if(!definesText.empty())
+            name += " [" + definesText + "]";
+        // 1. expand includes and defines, the expanded sources are cached across programs
+        for(int i = 0; i < 3; i++)
+            sources[i] = paths[i] != nullptr ? &ShaderPreprocessor::expand(paths[i], defines) : nullptr;
+        binaryKey = programKey();
+
+        // 2. load the linked program from the binary cache, compile it on a miss
+        ID = glCreateProgram();
+        pendingPrograms++;
+        if(loadProgramBinary(binaryKey))
+        {
+            cachedPrograms++;
+            finishProgram(true);
+            return;
+        }
+        submitProgram();
+        if(!deferred)
+            finish();
+    }
 
-    void includeShaders(std::string path, std::string content)
+    static const char *stageName(GLenum type)
     {
-        std::string basePath = path.substr(0, path.find_last_of("/"));
-        size_t pos = content.find("#include");
-        while (pos != std::string::npos)
+        switch(type)
         {
-            size_t start = content.find("\"", pos);
-            size_t end = content.find("\"", start + 1);
-            std::string includeFile = content.substr(start + 1, end - start - 1);
-            std::string includePath = basePath + includeFile;
-            if (shaderIncludes.find(includePath) == shaderIncludes.end())
+            case GL_VERTEX_SHADER: return "VERTEX";
+            case GL_FRAGMENT_SHADER: return "FRAGMENT";
+            case GL_GEOMETRY_SHADER: return "GEOMETRY";
+            case GL_COMPUTE_SHADER: return "COMPUTE";
+            default: return "UNKNOWN";
+        }
+    }
+
+    // issues compile and link without asking for their status, which would wait for them
+    void submitProgram()
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            stages[i] = 0;
+            if(sources[i] == nullptr)
+                continue;
+            const char *code = sources[i]->code.c_str();
+            stages[i] = glCreateShader(stageTypes[i]);
+            glShaderSource(stages[i], 1, &code, NULL);
+            glCompileShader(stages[i]);
+        }
+        // shader Program, the binary is read back for the cache
+        glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        for(int i = 0; i < 3; i++)
+            if(stages[i] != 0)
+                glAttachShader(ID, stages[i]);
+        glLinkProgram(ID);
+    }
+
+    void finishProgram(bool cached)
+    {
+        if(!cached)
+        {
+            for(int i = 0; i < 3; i++)
+                if(stages[i] != 0)
+                    checkCompileErrors(stages[i], stageName(stageTypes[i]), sources[i]);
+            checkCompileErrors(ID, "PROGRAM");
+            // delete the shaders as they're linked into our program now and no longer necessary
+            for(int i = 0; i < 3; i++)
             {
-                std::ifstream file(includePath);
-                if (file.is_open())
-                {
-                    std::stringstream buffer;
-                    buffer << file.rdbuf();
-                    shaderIncludes[includePath] = buffer.str();
-                    // recursively include other includes
-                    includeShaders(includePath, shaderIncludes[includePath]);
-
-                    // add the include to the GL_SHADER_INCLUDE_ARB
-                    glNamedStringARB(GL_SHADER_INCLUDE_ARB, includeFile.size(), includeFile.c_str(), shaderIncludes[includePath].size(), shaderIncludes[includePath].c_str());
-                    std::cout << "Included: " << includePath << std::endl;
-                }
-                else
-                {
-                    std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND: " << includePath << std::endl;
-                }
+                if(stages[i] == 0)
+                    continue;
+                glDetachShader(ID, stages[i]);
+                glDeleteShader(stages[i]);
+                stages[i] = 0;
             }
+            saveProgramBinary(binaryKey);
+            compiledPrograms++;
+        }
+        introspectUniforms();
+        ready = true;
+        pendingPrograms--;
+
+        if(!verbose)
+            return;
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        std::cout << (cached ? "Shader cache hit: " : "Shader compiled: ") << name << " in " << ms << " ms" << std::endl;
+    }
+
+    // program binary cache
+    // ------------------------------------------------------------------------
+    struct ProgramBinaryHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint32_t format;
+        uint32_t size;
+    };
+
+    static std::string programBinaryPath(uint64_t key)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+        return std::string(SHADER_CACHE_DIR) + name;
+    }
+
+    // binaries are only valid for the driver that produced them, so the driver strings
+    // are part of the key together with every stage's expanded source, defines included
+    uint64_t programKey()
+    {
+        uint64_t h = 14695981039346656037ull;
+        const GLenum driverStrings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+        for(GLenum name : driverStrings)
+        {
+            const char *value = reinterpret_cast<const char*>(glGetString(name));
+            h = hashBytes(h, value, value != nullptr ? strlen(value) + 1 : 0);
+        }
+        for(int stage = 0; stage < 3; stage++)
+        {
+            // the stage type separates "no geometry shader" from an empty one
+            h = hashBytes(h, &stageTypes[stage], sizeof(GLenum));
+            if(sources[stage] != nullptr)
+                h = hashBytes(h, sources[stage]->code.data(), sources[stage]->code.size());
+        }
+        return h;
+    }
+
+    // returns false if there is no usable binary, the program is then still unlinked
+    bool loadProgramBinary(uint64_t key)
+    {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if(formats <= 0)
+            return false;
+        std::ifstream file(programBinaryPath(key), std::ios::binary);
+        if(!file.is_open())
+            return false;
+        ProgramBinaryHeader header;
+        if(!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+           header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION || header.key != key)
+            return false;
+        std::vector<char> binary(header.size);
+        if(!file.read(binary.data(), binary.size()))
+            return false;
+        glProgramBinary(ID, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+        GLint success = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if(!success)
+        {
+            // usually a driver update, the binary is replaced after compiling
+            std::cout << "WARNING::SHADER::PROGRAM_BINARY_REJECTED: " << programBinaryPath(key) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void saveProgramBinary(uint64_t key)
+    {
+        GLint success = 0, length = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(!success || length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(ID, length, &length, &format, binary.data());
+
+        std::error_code error;
+        std::filesystem::create_directories(SHADER_CACHE_DIR, error);
+        std::ofstream file(programBinaryPath(key), std::ios::binary | std::ios::trunc);
+        if(!file.is_open())
+        {
+            std::cout << "WARNING::SHADER::PROGRAM_BINARY_NOT_WRITTEN: " << programBinaryPath(key) << std::endl;
+            return;
+        }
+        ProgramBinaryHeader header = {SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, key, format, static_cast<uint32_t>(length)};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(binary.data(), length);
+    }
+
+    // build state, the sources live in the ShaderPreprocessor cache
+    std::string name;
+    const ShaderSource *sources[3] = {nullptr, nullptr, nullptr};
+    GLenum stageTypes[3] = {0, 0, 0};
+    unsigned int stages[3] = {0, 0, 0};
+    uint64_t binaryKey = 0;
+    bool ready = false;
+    bool materialTable = false;
+    std::chrono::steady_clock::time_point startTime;
 
-            pos = content.find("#include", pos + 1);
+    struct UniformEntry
+    {
+        std::string name;
+        GLint location;
+    };
+    // name hash -> location, filled from the active uniforms after linking
+    mutable std::unordered_map<uint64_t, UniformEntry> uniformLocations;
+    // sampler name hash -> texture unit, the location member holds the unit
+    std::unordered_map<uint64_t, UniformEntry> samplerUnits;
+
+    struct TextureBinding
+    {
+        GLuint unit;
+        GLenum target;
+        GLuint texture;
+    };
+    // material id -> textures this program reads and their units
+    mutable std::unordered_map<unsigned int, std::vector<TextureBinding>> materialBindings;
+
+    static uint64_t hashBytes(uint64_t h, const void *data, size_t size)
+    {
+        // FNV-1a
+        const unsigned char *bytes = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < size; i++)
+        {
+            h ^= bytes[i];
+            h *= 1099511628211ull;
         }
+        return h;
     }
+
+    static uint64_t hashName(const char *name)
+    {
+        // FNV-1a
+        uint64_t h = 14695981039346656037ull;
+        for(; *name; name++)
+        {
+            h ^= static_cast<unsigned char>(*name);
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    static bool isSampler(GLenum type)
+    {
+        switch(type)
+        {
+            case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE: case GL_SAMPLER_2D_ARRAY:
+            case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_CUBE_SHADOW: case GL_SAMPLER_2D_ARRAY_SHADOW:
+            case GL_SAMPLER_2D_MULTISAMPLE: case GL_SAMPLER_BUFFER:
+            case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // records the location of every active uniform, arrays also under their plain name.
+    // samplers are assigned consecutive texture units here, once, so drawing only binds textures.
+    void introspectUniforms()
+    {
+        uniformLocations.clear();
+        samplerUnits.clear();
+        materialBindings.clear();
+        GLint maxUnits = 0, nextUnit = 0;
+        glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &maxUnits);
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::string name(maxLength > 0 ? maxLength : 1, '\0');
+        for(GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, i, maxLength, &length, &size, &type, &name[0]);
+            std::string uniformName = name.substr(0, length);
+            // block members have no location
+            GLint location = glGetUniformLocation(ID, uniformName.c_str());
+            if(location < 0)
+                continue;
+            uniformLocations[hashName(uniformName.c_str())] = {uniformName, location};
+            size_t bracket = uniformName.find("[0]");
+            bool array = bracket != std::string::npos && bracket + 3 == uniformName.size();
+            std::string baseName = array ? uniformName.substr(0, bracket) : uniformName;
+            if(array)
+                uniformLocations[hashName(baseName.c_str())] = {baseName, location};
+
+            if(!isSampler(type))
+                continue;
+            if(nextUnit + size > maxUnits)
+            {
+                std::cout << "ERROR::SHADER::OUT_OF_TEXTURE_UNITS: " << uniformName << " in " << this->name << std::endl;
+                continue;
+            }
+            // array elements get consecutive units and can be bound as name[i]
+            std::vector<GLint> units(size);
+            for(GLint element = 0; element < size; element++)
+            {
+                units[element] = nextUnit + element;
+                std::string elementName = array ? baseName + "[" + std::to_string(element) + "]" : baseName;
+                samplerUnits[hashName(elementName.c_str())] = {elementName, units[element]};
+            }
+            if(array)
+                samplerUnits[hashName(baseName.c_str())] = {baseName, nextUnit};
+            glProgramUniform1iv(ID, location, size, units.data());
+            nextUnit += size;
+        }
+
+        projectionUniform = getUniform<glm::mat4>("projection");
+        viewUniform = getUniform<glm::mat4>("view");
+        cameraPosUniform = getUniform<glm::vec3>("cameraPos");
+        screenResolutionUniform = getUniform<glm::vec2>("screenResolution");
+        drawOffsetUniform = getUniform<unsigned int>("GL_DrawOffset");
+        materialTable = glGetProgramResourceIndex(ID, GL_SHADER_STORAGE_BLOCK, "GL_MATERIAL_BUFFER") != GL_INVALID_INDEX;
+    }
+};
+
+// the specialized programs of one set of stages, built the first time a define set is
+// requested and kept for the lifetime of the object
+class ShaderPermutations
+{
+public:
+    ShaderPermutations(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath), geometryPath(geometryPath != nullptr ? geometryPath : "") {}
+
+    // a new permutation is built deferred if asked to, see Shader
+    Shader &get(const ShaderDefines &defines = ShaderDefines(), bool deferred = false)
+    {
+        std::unique_ptr<Shader> &shader = permutations[ShaderPreprocessor::definesKey(defines)];
+        if(!shader)
+            shader.reset(new Shader(vertexPath.c_str(), fragmentPath.c_str(),
+                                    geometryPath.empty() ? nullptr : geometryPath.c_str(), defines, deferred));
+        return *shader;
+    }
+
+    size_t size() const
+    {
+        return permutations.size();
+    }
+
+private:
+    std::string vertexPath, fragmentPath, geometryPath;
+    std::unordered_map<std::string, std::unique_ptr<Shader>> permutations;
 };
 
-std::unordered_map<std::string, std::string> Shader::shaderIncludes;
+unsigned long Shader::locationQueries = 0;
+unsigned int Shader::cachedPrograms = 0;
+unsigned int Shader::compiledPrograms = 0;
+unsigned int Shader::pendingPrograms = 0;
+bool Shader::verbose = false;
 #endif
\ No newline at end of file
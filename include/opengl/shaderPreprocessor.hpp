@@ -0,0 +1,149 @@
+#ifndef SHADERPREPROCESSOR_H
+#define SHADERPREPROCESSOR_H
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// name -> value of the defines a program is specialized with. ordered, so equal sets
+// always produce the same source and the same cache key.
+typedef std::map<std::string, std::string> ShaderDefines;
+
+// a stage's source after preprocessing, ready for glShaderSource
+struct ShaderSource
+{
+    std::string code;
+    // files by GLSL source string number, #line directives refer to these indices
+    std::vector<std::string> files;
+};
+
+// expands #include on the CPU and injects defines right after #version.
+// include names are absolute, rooted at the directory of the top level shader, and each
+// file is inlined at most once per stage. files and expanded stages are cached.
+class ShaderPreprocessor
+{
+public:
+    static const ShaderSource &expand(const std::string &path, const ShaderDefines &defines = ShaderDefines())
+    {
+        std::string key = path + "|" + definesKey(defines);
+        auto it = expanded().find(key);
+        if(it != expanded().end())
+            return it->second;
+
+        ShaderSource &source = expanded()[key];
+        std::string root = path.substr(0, path.find_last_of("/"));
+        std::unordered_set<std::string> seen;
+        seen.insert(path);
+        source.files.push_back(path);
+        expandFile(source, root, path, 0, defines, seen);
+        return source;
+    }
+
+    // compact text form of a define set, empty when there are none
+    static std::string definesKey(const ShaderDefines &defines)
+    {
+        std::string key;
+        for(const auto &define : defines)
+        {
+            key += define.first;
+            key += '=';
+            key += define.second;
+            key += ';';
+        }
+        return key;
+    }
+
+    // drops the cached files and stages, the next expand reads from disk again
+    static void clearCache()
+    {
+        files().clear();
+        expanded().clear();
+    }
+
+private:
+    static std::unordered_map<std::string, std::string> &files()
+    {
+        static std::unordered_map<std::string, std::string> cache;
+        return cache;
+    }
+
+    static std::unordered_map<std::string, ShaderSource> &expanded()
+    {
+        static std::unordered_map<std::string, ShaderSource> cache;
+        return cache;
+    }
+
+    static const std::string *readFile(const std::string &path)
+    {
+        auto it = files().find(path);
+        if(it != files().end())
+            return &it->second;
+        std::ifstream file(path);
+        if(!file.is_open())
+            return nullptr;
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        return &(files()[path] = buffer.str());
+    }
+
+    // appends the file to source.code, 'index' is its source string number
+    static void expandFile(ShaderSource &source, const std::string &root, const std::string &path, int index,
+                           const ShaderDefines &defines, std::unordered_set<std::string> &seen)
+    {
+        const std::string *content = readFile(path);
+        if(content == nullptr)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+            return;
+        }
+
+        std::istringstream lines(*content);
+        std::string line;
+        int lineNumber = 0;
+        while(std::getline(lines, line))
+        {
+            lineNumber++;
+            size_t first = line.find_first_not_of(" \t");
+            std::string directive = first == std::string::npos ? std::string() : line.substr(first);
+
+            if(directive.compare(0, 8, "#include") == 0)
+            {
+                size_t start = directive.find('"');
+                size_t end = directive.find('"', start + 1);
+                if(start == std::string::npos || end == std::string::npos)
+                {
+                    std::cout << "ERROR::SHADER::INVALID_INCLUDE: " << path << "(" << lineNumber << ")" << std::endl;
+                    source.code += '\n';
+                    continue;
+                }
+                std::string includePath = root + directive.substr(start + 1, end - start - 1);
+                if(seen.insert(includePath).second)
+                {
+                    int includeIndex = static_cast<int>(source.files.size());
+                    source.files.push_back(includePath);
+                    source.code += "#line 1 " + std::to_string(includeIndex) + "\n";
+                    expandFile(source, root, includePath, includeIndex, defines, seen);
+                }
+                // continue with the line after the #include
+                source.code += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(index) + "\n";
+                continue;
+            }
+
+            source.code += line;
+            source.code += '\n';
+            if(index == 0 && directive.compare(0, 8, "#version") == 0)
+            {
+                for(const auto &define : defines)
+                    source.code += "#define " + define.first + " " + define.second + "\n";
+                source.code += "#line " + std::to_string(lineNumber + 1) + " 0\n";
+            }
+        }
+    }
+};
+
+#endif
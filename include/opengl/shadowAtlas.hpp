@@ -0,0 +1,359 @@
+#ifndef SHADOWATLAS_H
+#define SHADOWATLAS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <opengl/shader.hpp>
+#include <opengl/model.hpp>
+#include <opengl/light.hpp>
+#include <opengl/camera.hpp>
+#include <opengl/drawQueue.hpp>
+#include <opengl/ringBuffer.hpp>
+#include <opengl/glState.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+using namespace std;
+
+#define SHADOW_VERTEX_SHADER_PATH "../resources/shaders/shadow.vs"
+#define SHADOW_FRAGMENT_SHADER_PATH "../resources/shaders/shadow.fs"
+// shader storage binding of the shadow records, see shadow.glsl
+#define SHADOW_DATA_BINDING 12
+#define SHADOW_ATLAS_SIZE 4096
+// tiles are placed on a grid of cells of this size
+#define SHADOW_CELL_SIZE 256
+#define SHADOW_DIRECTIONAL_SIZE 2048
+// spot lights with a shadow map, the most important ones get the largest tiles
+#define SHADOW_MAX_SPOT_LIGHTS 32
+#define SHADOW_SPOT_NEAR 0.05f
+// normal offset in texels
+#define SHADOW_NORMAL_OFFSET 1.5f
+
+// std430 layout of GL_ShadowData
+struct ShadowData
+{
+    glm::mat4 viewProjection;
+    // xy: offset, zw: size of the tile in atlas uv
+    glm::vec4 rect;
+    // x: 1 if the record is in use, y: normal offset per unit of clip w
+    glm::vec4 params;
+};
+
+// shadow maps of the directional light and the most important spot lights, packed into
+// one depth atlas that every lit program samples, mirrors included, so reflections never
+// render shadows of their own. a light's tile is sized by its importance to the camera.
+// static casters are rendered into a cached atlas only when a tile's light or placement
+// changes; dynamic models (Model::dynamic) are drawn every frame over a copy of the
+// cached tiles. the directional light's frustum covers the static casters.
+class ShadowAtlas
+{
+public:
+    // created on first use, a GL context must be current by then
+    static ShadowAtlas &instance()
+    {
+        static ShadowAtlas atlas;
+        return atlas;
+    }
+
+    // tiles rendered since the start, static ones included. unchanged lights render none.
+    unsigned long renderedTiles = 0;
+
+    // assigns the tiles, renders what is out of date and writes the records. call once per
+    // frame before lightManager.Attach(), which uploads the spot lights' shadow records.
+    void update(LightManager &lightManager, Camera &camera, vector<Model> &casters)
+    {
+        records.clear();
+        if(!shadowShader.isReady())
+        {
+            // nothing is shadowed until the program is ready
+            records.push_back(ShadowData());
+            recordBuffer.write(records.data(), sizeof(ShadowData));
+            return;
+        }
+        // the program links deferred, so its uniform is looked up once it is ready
+        if(!uniformsFound)
+        {
+            viewProjectionUniform = shadowShader.getUniform<glm::mat4>("GL_ShadowViewProjection");
+            uniformsFound = true;
+        }
+        tiles.clear();
+        bool dynamic = false;
+        for(Model &model : casters)
+            dynamic |= model.dynamic;
+
+        // record 0, the directional light
+        glm::vec3 center;
+        float radius;
+        staticBounds(casters, center, radius);
+        ShadowData directional = {};
+        if(radius > 0.0f && lightManager.getDirectionalLight().intensity > 0.0f)
+        {
+            glm::vec3 direction = lightManager.getDirectionalLight().direction;
+            glm::mat4 view = glm::lookAt(center - direction * radius * 2.0f, center, upVector(direction));
+            glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, radius, radius * 3.0f);
+            directional.viewProjection = projection * view;
+            directional.params = glm::vec4(1.0f, 2.0f * radius / SHADOW_DIRECTIONAL_SIZE * SHADOW_NORMAL_OFFSET, 0.0f, 0.0f);
+            tiles.push_back({0, SHADOW_DIRECTIONAL_SIZE});
+        }
+        records.push_back(directional);
+
+        // spot lights by importance, the rest goes without shadows
+        ranked.clear();
+        spotRecords.assign(lightManager.getSpotLightCount(), -1);
+        for(unsigned int i = 0; i < lightManager.getSpotLightCount(); i++)
+        {
+            const SpotLight &light = lightManager.getSpotLight(i);
+            // the color is premultiplied by the intensity
+            float brightest = std::max(light.color.r, std::max(light.color.g, light.color.b));
+            float distance = glm::length(glm::vec3(light.position) - camera.Position);
+            float importance = brightest / std::max(distance * distance, 1.0f);
+            if(importance > 0.0f)
+                ranked.push_back({importance, i});
+        }
+        std::sort(ranked.begin(), ranked.end(), [](const RankedLight &a, const RankedLight &b)
+        {
+            return a.importance > b.importance;
+        });
+        for(unsigned int rank = 0; rank < ranked.size() && rank < SHADOW_MAX_SPOT_LIGHTS; rank++)
+        {
+            const SpotLight &light = lightManager.getSpotLight(ranked[rank].light);
+            float fov = std::min(2.0f * std::acos(glm::clamp(light.direction.w, -1.0f, 1.0f)), glm::radians(170.0f));
+            glm::vec3 position = glm::vec3(light.position);
+            glm::vec3 direction = glm::vec3(light.direction);
+            glm::mat4 view = glm::lookAt(position, position + direction, upVector(direction));
+            glm::mat4 projection = glm::perspective(fov, 1.0f, SHADOW_SPOT_NEAR, std::max(light.position.w, SHADOW_SPOT_NEAR * 2.0f));
+            int size = rank < 2 ? 1024 : rank < 8 ? 512 : 256;
+            ShadowData record = {};
+            record.viewProjection = projection * view;
+            record.params = glm::vec4(1.0f, 2.0f * std::tan(fov * 0.5f) / size * SHADOW_NORMAL_OFFSET, 0.0f, 0.0f);
+            spotRecords[ranked[rank].light] = static_cast<int>(records.size());
+            tiles.push_back({static_cast<unsigned int>(records.size()), size});
+            records.push_back(record);
+        }
+        // only records that changed are uploaded with the lights
+        for(unsigned int i = 0; i < spotRecords.size(); i++)
+            lightManager.setSpotLightShadow(i, spotRecords[i]);
+        placeTiles();
+
+        render(casters, dynamic);
+        recordBuffer.write(records.data(), records.size() * sizeof(ShadowData));
+        sampledAtlas = dynamic ? liveAtlas : staticAtlas;
+    }
+
+    // cached static shadows are redrawn, call after static casters moved
+    void invalidateStatic()
+    {
+        cachedTiles.clear();
+    }
+
+    // binds the records and the atlas for a program compiled with LIGHT_SHADOWS. programs
+    // without shadows are skipped, so the atlas is never created when nothing samples it.
+    static void bind(const Shader &shader)
+    {
+        if(shader.getTextureUnit("GL_ShadowAtlas") < 0)
+            return;
+        ShadowAtlas &atlas = instance();
+        atlas.recordBuffer.bindBase(SHADOW_DATA_BINDING);
+        shader.bindTexture("GL_ShadowAtlas", GL_TEXTURE_2D, atlas.sampledAtlas);
+    }
+
+private:
+    struct Tile
+    {
+        // record the tile belongs to
+        unsigned int record;
+        int size;
+        int x = 0, y = 0;
+    };
+
+    // a tile of the static atlas and the light it was rendered for
+    struct CachedTile
+    {
+        int x, y, size;
+        glm::mat4 viewProjection;
+    };
+
+    struct RankedLight
+    {
+        float importance;
+        unsigned int light;
+    };
+
+    Shader shadowShader;
+    Uniform<glm::mat4> viewProjectionUniform;
+    bool uniformsFound = false;
+    GLuint staticAtlas, liveAtlas, sampledAtlas;
+    GLuint staticFramebuffer, liveFramebuffer;
+    RingBuffer recordBuffer = RingBuffer(GL_SHADER_STORAGE_BUFFER);
+    DrawQueue staticQueue, dynamicQueue;
+    vector<ShadowData> records;
+    vector<Tile> tiles;
+    vector<CachedTile> cachedTiles;
+    vector<RankedLight> ranked;
+    vector<int> spotRecords;
+
+    // the program is built deferred, update() does nothing until it is ready
+    ShadowAtlas() : shadowShader(Shader(SHADOW_VERTEX_SHADER_PATH, SHADOW_FRAGMENT_SHADER_PATH, nullptr, ShaderDefines(), true))
+    {
+        staticAtlas = createAtlas(staticFramebuffer);
+        liveAtlas = createAtlas(liveFramebuffer);
+        sampledAtlas = staticAtlas;
+        recordBuffer.reserve((1 + SHADOW_MAX_SPOT_LIGHTS) * sizeof(ShadowData));
+        records.reserve(1 + SHADOW_MAX_SPOT_LIGHTS);
+        tiles.reserve(1 + SHADOW_MAX_SPOT_LIGHTS);
+        cachedTiles.reserve(1 + SHADOW_MAX_SPOT_LIGHTS);
+    }
+
+    static GLuint createAtlas(GLuint &framebuffer)
+    {
+        GLuint texture;
+        glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+        glTextureStorage2D(texture, 1, GL_DEPTH_COMPONENT32F, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE);
+        // hardware compare, linear filtering gives a bilinear weighted result
+        glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(texture, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTextureParameteri(texture, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        float clearDepth = 1.0f;
+        glClearTexImage(texture, 0, GL_DEPTH_COMPONENT, GL_FLOAT, &clearDepth);
+
+        glCreateFramebuffers(1, &framebuffer);
+        glNamedFramebufferTexture(framebuffer, GL_DEPTH_ATTACHMENT, texture, 0);
+        glNamedFramebufferDrawBuffer(framebuffer, GL_NONE);
+        if(glCheckNamedFramebufferStatus(framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SHADOWATLAS::INCOMPLETE_FRAMEBUFFER" << std::endl;
+        return texture;
+    }
+
+    static glm::vec3 upVector(glm::vec3 direction)
+    {
+        return std::abs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+
+    // bounding sphere of the static casters' meshes
+    static void staticBounds(vector<Model> &casters, glm::vec3 &center, float &radius)
+    {
+        glm::vec3 minPos(INFINITY), maxPos(-INFINITY);
+        for(Model &model : casters)
+        {
+            if(model.dynamic)
+                continue;
+            for(const Mesh &mesh : model.meshes)
+            {
+                glm::vec3 meshCenter;
+                float meshRadius;
+                model.getMeshBounds(mesh, meshCenter, meshRadius);
+                minPos = glm::min(minPos, meshCenter - meshRadius);
+                maxPos = glm::max(maxPos, meshCenter + meshRadius);
+            }
+        }
+        if(minPos.x > maxPos.x)
+        {
+            center = glm::vec3(0.0f);
+            radius = 0.0f;
+            return;
+        }
+        center = (minPos + maxPos) * 0.5f;
+        radius = glm::length(maxPos - minPos) * 0.5f;
+    }
+
+    // tiles are powers of two placed largest first along a Morton curve over the cell
+    // grid, so every tile starts on a cell aligned to its own size and none overlap
+    void placeTiles()
+    {
+        // std::stable_sort would allocate, the record keeps equal sizes in order
+        std::sort(tiles.begin(), tiles.end(), [](const Tile &a, const Tile &b)
+        {
+            return a.size != b.size ? a.size > b.size : a.record < b.record;
+        });
+        const unsigned int cellsPerSide = SHADOW_ATLAS_SIZE / SHADOW_CELL_SIZE;
+        unsigned int cursor = 0;
+        for(Tile &tile : tiles)
+        {
+            unsigned int cells = tile.size / SHADOW_CELL_SIZE;
+            unsigned int x = 0, y = 0;
+            for(unsigned int bit = 0; (1u << bit) < cellsPerSide; bit++)
+            {
+                x |= ((cursor >> (2 * bit)) & 1u) << bit;
+                y |= ((cursor >> (2 * bit + 1)) & 1u) << bit;
+            }
+            cursor += cells * cells;
+            tile.x = x * SHADOW_CELL_SIZE;
+            tile.y = y * SHADOW_CELL_SIZE;
+            records[tile.record].rect = glm::vec4(tile.x, tile.y, tile.size, tile.size) / static_cast<float>(SHADOW_ATLAS_SIZE);
+        }
+    }
+
+    bool cached(const Tile &tile)
+    {
+        for(const CachedTile &cachedTile : cachedTiles)
+            if(cachedTile.x == tile.x && cachedTile.y == tile.y && cachedTile.size == tile.size
+               && cachedTile.viewProjection == records[tile.record].viewProjection)
+                return true;
+        return false;
+    }
+
+    // the tile now holds the static shadows of its light, tiles it overlaps are lost
+    void cache(const Tile &tile)
+    {
+        cachedTiles.erase(std::remove_if(cachedTiles.begin(), cachedTiles.end(), [&tile](const CachedTile &other)
+        {
+            return other.x < tile.x + tile.size && tile.x < other.x + other.size
+                && other.y < tile.y + tile.size && tile.y < other.y + other.size;
+        }), cachedTiles.end());
+        cachedTiles.push_back({tile.x, tile.y, tile.size, records[tile.record].viewProjection});
+    }
+
+    void render(vector<Model> &casters, bool dynamic)
+    {
+        GLState &state = GLState::instance();
+        GLint viewport[4];
+        state.getViewport(viewport);
+        state.setEnabled(GL_DEPTH_TEST, true);
+        state.depthMask(true);
+        // slope scaled bias against acne, the normal offset in shadow.glsl does the rest
+        state.setEnabled(GL_POLYGON_OFFSET_FILL, true);
+        glPolygonOffset(2.0f, 4.0f);
+        shadowShader.use();
+
+        staticQueue.clear();
+        dynamicQueue.clear();
+        for(Model &model : casters)
+            model.Submit(model.dynamic ? dynamicQueue : staticQueue);
+
+        const float clearDepth = 1.0f;
+        for(const Tile &tile : tiles)
+        {
+            shadowShader.set(viewProjectionUniform, records[tile.record].viewProjection);
+            if(!cached(tile))
+            {
+                glClearTexSubImage(staticAtlas, 0, tile.x, tile.y, 0, tile.size, tile.size, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &clearDepth);
+                state.bindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
+                state.viewport(tile.x, tile.y, tile.size, tile.size);
+                staticQueue.Draw(shadowShader, true);
+                cache(tile);
+                renderedTiles++;
+            }
+            if(!dynamic)
+                continue;
+            // dynamic casters over the cached static ones
+            glCopyImageSubData(staticAtlas, GL_TEXTURE_2D, 0, tile.x, tile.y, 0,
+                               liveAtlas, GL_TEXTURE_2D, 0, tile.x, tile.y, 0, tile.size, tile.size, 1);
+            state.bindFramebuffer(GL_FRAMEBUFFER, liveFramebuffer);
+            state.viewport(tile.x, tile.y, tile.size, tile.size);
+            dynamicQueue.Draw(shadowShader, true);
+            renderedTiles++;
+        }
+
+        state.setEnabled(GL_POLYGON_OFFSET_FILL, false);
+        state.bindFramebuffer(GL_FRAMEBUFFER, 0);
+        state.viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+};
+
+#endif
@@ -8,11 +8,36 @@
 #include <vector>
 
 #include <opengl/shader.hpp>
+#include <opengl/glState.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#define ENV_PREFILTER_SHADER_PATH "../resources/shaders/env_prefilter.cs"
+// the prefiltered chain is cached next to the first face
+#define ENV_CACHE_NAME "prefiltered.env"
+#define ENV_CACHE_VERSION 2
+#define ENV_PREFILTER_SIZE 512
+// level l is filtered for roughness l / (ENV_PREFILTER_LEVELS - 1)
+#define ENV_PREFILTER_LEVELS 6
+#define ENV_PREFILTER_SAMPLES 256
+// faces are averaged down to this many texels per side before the SH projection
+#define ENV_SH_SIZE 64
 
 class SkyBox
 {
 public:
     unsigned int ID;
+    // GGX prefiltered copy of the cubemap that reflections read, 0 until loaded
+    GLuint prefilteredID = 0;
+    // irradiance of the sky as 9 SH coefficients, divided by pi and premultiplied by the
+    // basis constants, see GL_AmbientSH in frame.glsl. a white sky until loaded.
+    glm::vec3 irradiance[9] = {glm::vec3(1.0f)};
     SkyBox()
     {
         float skyboxVertices[] = {
@@ -62,23 +87,27 @@ public:
 
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
-        glBindVertexArray(VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        GLState &state = GLState::instance();
+        state.bindVertexArray(VAO);
+        state.bindBuffer(GL_ARRAY_BUFFER, VBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
     }
 
+    // loads the faces, then the prefiltered chain from its cache or, on a miss or after a
+    // face changed, filters it with env_prefilter.cs and writes the cache
     void loadTexture(std::vector<std::string> faces, bool flip = true)
     {
         glGenTextures(1, &ID);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, ID);
+        GLState::instance().bindTexture(0, GL_TEXTURE_CUBE_MAP, ID);
 
         stbi_set_flip_vertically_on_load(flip); 
 
-        int width, height, nrChannels;
+        int width = 0, height, nrChannels;
+        // FNV-1a over the face pixels, enough to notice a changed face
+        uint64_t key = 14695981039346656037ull;
+        std::vector<float> shFaces(static_cast<size_t>(6) * ENV_SH_SIZE * ENV_SH_SIZE * 3, 0.0f);
         for (unsigned int i = 0; i < faces.size(); i++)
         {
             std::cout<<faces[i]<<std::endl;
@@ -86,6 +115,14 @@ public:
             if (data)
             {
                 glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+                size_t size = static_cast<size_t>(width) * height * nrChannels;
+                for(size_t b = 0; b < size; b++)
+                {
+                    key ^= data[b];
+                    key *= 1099511628211ull;
+                }
+                if(i < 6)
+                    downsampleFace(data, width, height, nrChannels, shFaces.data() + i * ENV_SH_SIZE * ENV_SH_SIZE * 3);
                 stbi_image_free(data);
             }
             else
@@ -100,33 +137,227 @@ public:
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
+        // the box filtered mips are only for drawing the sky and as the prefilter's source
         glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        if(faces.empty() || width <= 0)
+            return;
+        std::string cachePath = (std::filesystem::path(faces[0]).parent_path() / ENV_CACHE_NAME).string();
+        createPrefiltered();
+        if(!readPrefilteredCache(cachePath, key))
+        {
+            projectIrradiance(shFaces);
+            prefilter(width);
+            writePrefilteredCache(cachePath, key);
+        }
     }
     
-    void Attach(Shader &shader, int textureOffset = 0)
+    // binds the prefiltered cubemap to the shader's texture_skybox unit. level l holds the
+    // sky as reflected by a surface of roughness l / (ENV_PREFILTER_LEVELS - 1), so a
+    // blurred mirror reads its reflection with a single textureLod.
+    void Attach(Shader &shader)
     {
-        glActiveTexture(GL_TEXTURE0 + textureOffset);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, ID);
-        glActiveTexture(GL_TEXTURE0);
-        shader.setInt("texture_skybox", textureOffset);
+        shader.bindTexture("texture_skybox", GL_TEXTURE_CUBE_MAP, prefilteredID != 0 ? prefilteredID : ID);
     }
 
     void Draw(Shader& shader)
     {
-        glDepthFunc(GL_LEQUAL);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, ID);
-        shader.setInt("texture_skybox", 0);
-        glBindVertexArray(VAO);
+        GLState &state = GLState::instance();
+        state.depthFunc(GL_LEQUAL);
+        shader.bindTexture("texture_skybox", GL_TEXTURE_CUBE_MAP, ID);
+        state.bindVertexArray(VAO);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-        glDepthFunc(GL_LESS);
+        state.depthFunc(GL_LESS);
     }
 
 private:
     GLuint VAO, VBO;
+
+    // cache layout: header, then every level with all faces as RGBA half floats
+    struct EnvCacheHeader
+    {
+        uint32_t version;
+        uint32_t size;
+        uint32_t levels;
+        uint32_t samples;
+        uint64_t key;
+        glm::vec3 irradiance[9];
+    };
+
+    static size_t levelBytes(int level)
+    {
+        size_t size = ENV_PREFILTER_SIZE >> level;
+        return size * size * 6 * 4 * sizeof(uint16_t);
+    }
+
+    void createPrefiltered()
+    {
+        glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &prefilteredID);
+        glTextureStorage2D(prefilteredID, ENV_PREFILTER_LEVELS, GL_RGBA16F, ENV_PREFILTER_SIZE, ENV_PREFILTER_SIZE);
+        glTextureParameteri(prefilteredID, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTextureParameteri(prefilteredID, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTextureParameteri(prefilteredID, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(prefilteredID, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(prefilteredID, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    }
+
+    // box filters a face down to ENV_SH_SIZE^2 rgb texels in [0, 1]
+    static void downsampleFace(const unsigned char *data, int width, int height, int channels, float *face)
+    {
+        for(int y = 0; y < ENV_SH_SIZE; y++)
+        {
+            int y0 = y * height / ENV_SH_SIZE, y1 = std::max((y + 1) * height / ENV_SH_SIZE, y0 + 1);
+            for(int x = 0; x < ENV_SH_SIZE; x++)
+            {
+                int x0 = x * width / ENV_SH_SIZE, x1 = std::max((x + 1) * width / ENV_SH_SIZE, x0 + 1);
+                float sum[3] = {0.0f, 0.0f, 0.0f};
+                for(int sy = y0; sy < y1; sy++)
+                {
+                    const unsigned char *row = data + (static_cast<size_t>(sy) * width + x0) * channels;
+                    for(int sx = 0; sx < x1 - x0; sx++)
+                        for(int c = 0; c < 3; c++)
+                            sum[c] += row[sx * channels + std::min(c, channels - 1)];
+                }
+                float scale = 1.0f / (255.0f * (x1 - x0) * (y1 - y0));
+                for(int c = 0; c < 3; c++)
+                    face[(y * ENV_SH_SIZE + x) * 3 + c] = sum[c] * scale;
+            }
+        }
+    }
+
+    // projects the downsampled faces onto the first 9 SH basis functions and convolves
+    // them with the cosine lobe. each face row is weighted as plain float arrays, so the
+    // inner loops vectorize.
+    void projectIrradiance(const std::vector<float> &faces)
+    {
+        const int n = ENV_SH_SIZE;
+        // texel centers in [-1, 1] and their solid angles, the same on every face
+        float coords[ENV_SH_SIZE];
+        for(int i = 0; i < n; i++)
+            coords[i] = (i + 0.5f) / n * 2.0f - 1.0f;
+
+        double sh[9][3] = {};
+        double totalWeight = 0.0;
+        float dx[ENV_SH_SIZE], dy[ENV_SH_SIZE], dz[ENV_SH_SIZE], weight[ENV_SH_SIZE];
+        for(int face = 0; face < 6; face++)
+        {
+            for(int y = 0; y < n; y++)
+            {
+                float v = coords[y];
+                for(int x = 0; x < n; x++)
+                {
+                    float u = coords[x];
+                    float d = 1.0f + u * u + v * v;
+                    float invLength = 1.0f / std::sqrt(d);
+                    weight[x] = invLength / d;
+                    // same face orientation as env_prefilter.cs
+                    float fx[6] = {1.0f, -1.0f, u, u, u, -u};
+                    float fy[6] = {-v, -v, 1.0f, -1.0f, -v, -v};
+                    float fz[6] = {-u, u, v, -v, 1.0f, -1.0f};
+                    dx[x] = fx[face] * invLength;
+                    dy[x] = fy[face] * invLength;
+                    dz[x] = fz[face] * invLength;
+                }
+                const float *row = faces.data() + (static_cast<size_t>(face) * n + y) * n * 3;
+                for(int c = 0; c < 3; c++)
+                {
+                    float sums[9] = {};
+                    for(int x = 0; x < n; x++)
+                    {
+                        float value = row[x * 3 + c] * weight[x];
+                        sums[0] += value;
+                        sums[1] += value * dy[x];
+                        sums[2] += value * dz[x];
+                        sums[3] += value * dx[x];
+                        sums[4] += value * dx[x] * dy[x];
+                        sums[5] += value * dy[x] * dz[x];
+                        sums[6] += value * (3.0f * dz[x] * dz[x] - 1.0f);
+                        sums[7] += value * dx[x] * dz[x];
+                        sums[8] += value * (dx[x] * dx[x] - dy[x] * dy[x]);
+                    }
+                    for(int i = 0; i < 9; i++)
+                        sh[i][c] += sums[i];
+                }
+                for(int x = 0; x < n; x++)
+                    totalWeight += weight[x];
+            }
+        }
+
+        // squared basis constants times the cosine lobe's band factors A_l / pi:
+        // 1, 2/3 and 1/4. the weights are normalized to the sphere's 4 pi.
+        const float basis[9] = {0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f};
+        const float band[9] = {1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f};
+        double solidAngle = 4.0 * 3.14159265358979 / totalWeight;
+        for(int i = 0; i < 9; i++)
+            irradiance[i] = glm::vec3(sh[i][0], sh[i][1], sh[i][2]) * static_cast<float>(solidAngle * basis[i] * basis[i] * band[i]);
+    }
+
+    // runs once at startup on a cache miss, so the program is built blocking
+    void prefilter(int sourceSize)
+    {
+        ShaderDefines defines;
+        defines["ENV_PREFILTER_SAMPLES"] = std::to_string(ENV_PREFILTER_SAMPLES);
+        Shader prefilterShader(ENV_PREFILTER_SHADER_PATH, defines);
+        prefilterShader.use();
+        prefilterShader.bindTexture("environment", GL_TEXTURE_CUBE_MAP, ID);
+        prefilterShader.setFloat("environmentSize", static_cast<float>(sourceSize));
+        for(int level = 0; level < ENV_PREFILTER_LEVELS; level++)
+        {
+            GLuint size = ENV_PREFILTER_SIZE >> level;
+            prefilterShader.setFloat("roughness", static_cast<float>(level) / (ENV_PREFILTER_LEVELS - 1));
+            glBindImageTexture(0, prefilteredID, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+            glDispatchCompute((size + 7) / 8, (size + 7) / 8, 6);
+        }
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+        GLState::instance().deleteProgram(prefilterShader.ID);
+    }
+
+    bool readPrefilteredCache(const std::string &cachePath, uint64_t key)
+    {
+        std::ifstream file(cachePath, std::ios::binary);
+        if(!file.is_open())
+            return false;
+        EnvCacheHeader header = {};
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if(!file || header.version != ENV_CACHE_VERSION || header.size != ENV_PREFILTER_SIZE ||
+           header.levels != ENV_PREFILTER_LEVELS || header.samples != ENV_PREFILTER_SAMPLES || header.key != key)
+            return false;
+        std::vector<char> pixels;
+        for(int level = 0; level < ENV_PREFILTER_LEVELS; level++)
+        {
+            pixels.resize(levelBytes(level));
+            file.read(pixels.data(), pixels.size());
+            if(!file)
+            {
+                std::cout << "ERROR::SKYBOX::ENV_CACHE_CORRUPT: " << cachePath << std::endl;
+                return false;
+            }
+            GLsizei size = ENV_PREFILTER_SIZE >> level;
+            glTextureSubImage3D(prefilteredID, level, 0, 0, 0, size, size, 6, GL_RGBA, GL_HALF_FLOAT, pixels.data());
+        }
+        std::copy(header.irradiance, header.irradiance + 9, irradiance);
+        return true;
+    }
+
+    void writePrefilteredCache(const std::string &cachePath, uint64_t key)
+    {
+        std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+        if(!file.is_open())
+        {
+            std::cout << "ERROR::SKYBOX::ENV_CACHE_NOT_WRITABLE: " << cachePath << std::endl;
+            return;
+        }
+        EnvCacheHeader header = {ENV_CACHE_VERSION, ENV_PREFILTER_SIZE, ENV_PREFILTER_LEVELS, ENV_PREFILTER_SAMPLES, key, {}};
+        std::copy(irradiance, irradiance + 9, header.irradiance);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::vector<char> pixels;
+        for(int level = 0; level < ENV_PREFILTER_LEVELS; level++)
+        {
+            pixels.resize(levelBytes(level));
+            glGetTextureImage(prefilteredID, level, GL_RGBA, GL_HALF_FLOAT, static_cast<GLsizei>(pixels.size()), pixels.data());
+            file.write(pixels.data(), pixels.size());
+        }
+    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,174 @@
+#ifndef VISIBILITYRENDERER_H
+#define VISIBILITYRENDERER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <opengl/shader.hpp>
+#include <opengl/shaderPreprocessor.hpp>
+#include <opengl/drawQueue.hpp>
+#include <opengl/geometryBuffer.hpp>
+#include <opengl/materialLibrary.hpp>
+#include <opengl/screenQuad.hpp>
+#include <opengl/shadowAtlas.hpp>
+#include <opengl/camera.hpp>
+#include <opengl/glState.hpp>
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#define VISIBILITY_VERTEX_SHADER_PATH "../resources/shaders/visibility.vs"
+#define VISIBILITY_FRAGMENT_SHADER_PATH "../resources/shaders/visibility.fs"
+#define VISIBILITY_RESOLVE_VERTEX_SHADER_PATH "../resources/shaders/screen_quad.vs"
+#define VISIBILITY_RESOLVE_FRAGMENT_SHADER_PATH "../resources/shaders/visibility_resolve.fs"
+// shader storage bindings of the resolve pass, see visibility_resolve.fs
+#define VISIBILITY_COMMAND_BINDING 8
+#define VISIBILITY_VERTEX_BINDING 9
+#define VISIBILITY_INDEX16_BINDING 10
+#define VISIBILITY_INDEX32_BINDING 11
+// a visibility id holds the triangle in its low bits and the draw in the rest:
+// 1024 draws of up to 4M triangles each
+#define VISIBILITY_TRIANGLE_BITS 22
+#define VISIBILITY_MAX_DRAWS (1u << (32 - VISIBILITY_TRIANGLE_BITS))
+
+// experimental: draws opaque geometry into a visibility buffer of (draw, triangle) ids,
+// then a fullscreen resolve fetches each pixel's triangle from the GeometryBuffer,
+// interpolates its attributes and shades it once. small triangles cost no quad overdraw
+// in the shading and vertices are only fetched for visible pixels. the queue is the same
+// DrawQueue the forward path draws, so both can be compared on one scene. materials are
+// read through the MaterialLibrary, which has to be available.
+class VisibilityRenderer
+{
+public:
+    // both programs are built deferred, Draw skips the pass until they are ready.
+    // lightDefines are the light defines, the material defines are added here.
+    VisibilityRenderer(const ShaderDefines &lightDefines)
+        : visibilityShader(Shader(VISIBILITY_VERTEX_SHADER_PATH, VISIBILITY_FRAGMENT_SHADER_PATH, nullptr, visibilityDefines(), true)),
+          resolveShaders(VISIBILITY_RESOLVE_VERTEX_SHADER_PATH, VISIBILITY_RESOLVE_FRAGMENT_SHADER_PATH)
+    {
+        setLightDefines(lightDefines);
+        glGenFramebuffers(1, &framebuffer);
+    }
+
+    // selects the resolve program for changed light defines, built deferred if new
+    void setLightDefines(const ShaderDefines &lightDefines)
+    {
+        resolveShader = &resolveShaders.get(resolveDefines(lightDefines), true);
+    }
+
+    // the resolve fetches materials by index only
+    static bool available()
+    {
+        return MaterialLibrary::instance().available();
+    }
+
+    bool isReady()
+    {
+        // both are polled, so both finish without blocking
+        bool visibilityReady = visibilityShader.isReady();
+        bool resolveReady = resolveShader->isReady();
+        return visibilityReady && resolveReady;
+    }
+
+    // draws the queued meshes and shades them into target, frame constants and lights
+    // bound. the visibility buffer follows the camera's resolution.
+    void Draw(DrawQueue &queue, Camera &camera, GLuint target = 0)
+    {
+        resize(static_cast<GLsizei>(camera.resolution.x), static_cast<GLsizei>(camera.resolution.y));
+        GLState &state = GLState::instance();
+
+        // visibility pass, ids are not blended
+        state.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        const GLuint empty[4] = {0xFFFFFFFFu, 0, 0, 0};
+        glClearBufferuiv(GL_COLOR, 0, empty);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        state.setEnabled(GL_BLEND, false);
+        visibilityShader.use();
+        queue.Draw(visibilityShader);
+        if(queue.drawCount() > VISIBILITY_MAX_DRAWS && !reportedOverflow)
+        {
+            reportedOverflow = true;
+            std::cout << "WARNING::VISIBILITYRENDERER::TOO_MANY_DRAWS: " << queue.drawCount() << std::endl;
+        }
+
+        // resolve pass, reads the draw data and commands the queue just submitted
+        GeometryBuffer &geometry = GeometryBuffer::instance();
+        state.bindFramebuffer(GL_FRAMEBUFFER, target);
+        resolveShader->use();
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBILITY_COMMAND_BINDING, queue.getCommandBuffer());
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBILITY_VERTEX_BINDING, geometry.getVertexBuffer(VERTEX_FORMAT_FULL));
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBILITY_INDEX16_BINDING, geometry.getIndexBuffer(GL_UNSIGNED_SHORT));
+        state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBILITY_INDEX32_BINDING, geometry.getIndexBuffer(GL_UNSIGNED_INT));
+        MaterialLibrary::instance().bind(*resolveShader);
+        ShadowAtlas::bind(*resolveShader);
+        resolveShader->bindTexture("visibility_ids", GL_TEXTURE_2D, idTexture);
+        resolveShader->bindTexture("visibility_depth", GL_TEXTURE_2D, depthTexture);
+        quad.DrawFullscreen();
+        state.setEnabled(GL_BLEND, true);
+    }
+
+private:
+    Shader visibilityShader;
+    ShaderPermutations resolveShaders;
+    Shader *resolveShader = nullptr;
+    ScreenQuad quad;
+    GLuint framebuffer;
+    GLuint idTexture = 0, depthTexture = 0;
+    GLsizei width = 0, height = 0;
+    bool reportedOverflow = false;
+
+    static ShaderDefines visibilityDefines()
+    {
+        ShaderDefines defines;
+        defines["VISIBILITY_TRIANGLE_BITS"] = std::to_string(VISIBILITY_TRIANGLE_BITS);
+        return defines;
+    }
+
+    // the Vertex layout in floats, the resolve reads the vertex pool as a float array
+    static ShaderDefines resolveDefines(const ShaderDefines &lightDefines)
+    {
+        ShaderDefines defines = lightDefines;
+        ShaderDefines materialDefines = MaterialLibrary::instance().getShaderDefines();
+        defines.insert(materialDefines.begin(), materialDefines.end());
+        defines["VISIBILITY_TRIANGLE_BITS"] = std::to_string(VISIBILITY_TRIANGLE_BITS);
+        defines["VISIBILITY_VERTEX_STRIDE"] = std::to_string(sizeof(Vertex) / sizeof(float));
+        defines["VISIBILITY_POSITION_OFFSET"] = std::to_string(offsetof(Vertex, Position) / sizeof(float)) + "u";
+        defines["VISIBILITY_NORMAL_OFFSET"] = std::to_string(offsetof(Vertex, Normal) / sizeof(float)) + "u";
+        defines["VISIBILITY_TEXCOORD_OFFSET"] = std::to_string(offsetof(Vertex, TexCoords) / sizeof(float)) + "u";
+        return defines;
+    }
+
+    // reallocates the attachments when the resolution changes
+    void resize(GLsizei newWidth, GLsizei newHeight)
+    {
+        if(newWidth == width && newHeight == height)
+            return;
+        width = newWidth;
+        height = newHeight;
+        GLState &state = GLState::instance();
+        for(GLuint *texture : {&idTexture, &depthTexture})
+            if(*texture != 0)
+                state.deleteTexture(*texture);
+
+        idTexture = createAttachment(GL_R32UI);
+        depthTexture = createAttachment(GL_DEPTH_COMPONENT32F);
+        glNamedFramebufferTexture(framebuffer, GL_COLOR_ATTACHMENT0, idTexture, 0);
+        glNamedFramebufferTexture(framebuffer, GL_DEPTH_ATTACHMENT, depthTexture, 0);
+        if(glCheckNamedFramebufferStatus(framebuffer, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::VISIBILITYRENDERER::INCOMPLETE_FRAMEBUFFER" << std::endl;
+    }
+
+    GLuint createAttachment(GLenum format)
+    {
+        GLuint texture;
+        glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+        glTextureStorage2D(texture, 1, format, width, height);
+        // read with texelFetch only
+        glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return texture;
+    }
+};
+
+#endif
@@ -0,0 +1,28 @@
+#version 460 core
+#include "/include/gbuffer.glsl"
+#include "/include/light.glsl"
+
+out vec4 FragColor;
+
+uniform sampler2D gbuffer_albedo;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_depth;
+
+// one fullscreen pass: every pixel covered by the G-buffer is lit once, with the lights
+// of its cluster. the depth is written back so mirrors and the skybox are depth tested
+// against the lit scene.
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gbuffer_depth, pixel, 0).r;
+    if(depth >= 1.0)
+        discard;
+    vec4 albedoSpecular = texelFetch(gbuffer_albedo, pixel, 0);
+    vec3 norm = GL_DecodeNormal(texelFetch(gbuffer_normal, pixel, 0).rg);
+    vec3 pos = GL_WorldFromDepth(gl_FragCoord.xy, depth);
+
+    vec3 kd = albedoSpecular.rgb;
+    vec3 ks = vec3(albedoSpecular.a);
+    FragColor = vec4(calculateLight(pos, norm, normalize(GL_CameraPos.xyz - pos), kd, ks, 0u, vec3(gl_FragCoord.xy, depth)), 1.0);
+    gl_FragDepth = depth;
+}
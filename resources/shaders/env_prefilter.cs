@@ -0,0 +1,96 @@
+#version 460 core
+
+// prefilters one level of the environment cubemap with the GGX distribution, assuming
+// the view along the normal. one invocation per texel and face.
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(rgba16f, binding = 0) uniform writeonly imageCube prefiltered;
+uniform samplerCube environment;
+// of the level written
+uniform float roughness;
+// texels along a face of the environment's base level
+uniform float environmentSize;
+
+#ifndef ENV_PREFILTER_SAMPLES
+#define ENV_PREFILTER_SAMPLES 256
+#endif
+
+const float PI = 3.14159265359;
+
+// world direction through the texel center, same face order and orientation as sampling
+vec3 cubeDirection(uvec3 texel, vec2 size)
+{
+    vec2 uv = (vec2(texel.xy) + 0.5) / size * 2.0 - 1.0;
+    switch(texel.z)
+    {
+    case 0u: return normalize(vec3(1.0, -uv.y, -uv.x));
+    case 1u: return normalize(vec3(-1.0, -uv.y, uv.x));
+    case 2u: return normalize(vec3(uv.x, 1.0, uv.y));
+    case 3u: return normalize(vec3(uv.x, -1.0, -uv.y));
+    case 4u: return normalize(vec3(uv.x, -uv.y, 1.0));
+    default: return normalize(vec3(-uv.x, -uv.y, -1.0));
+    }
+}
+
+vec2 hammersley(uint i, uint count)
+{
+    return vec2(float(i) / float(count), float(bitfieldReverse(i)) * 2.3283064365386963e-10);
+}
+
+// half vector around n for the GGX distribution of alpha = roughness^2
+vec3 importanceSampleGGX(vec2 xi, vec3 n, float alpha)
+{
+    float phi = 2.0 * PI * xi.x;
+    float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (alpha * alpha - 1.0) * xi.y));
+    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+    vec3 up = abs(n.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent = normalize(cross(up, n));
+    vec3 bitangent = cross(n, tangent);
+    return normalize(tangent * (cos(phi) * sinTheta) + bitangent * (sin(phi) * sinTheta) + n * cosTheta);
+}
+
+float distributionGGX(float nDotH, float alpha)
+{
+    float a2 = alpha * alpha;
+    float d = nDotH * nDotH * (a2 - 1.0) + 1.0;
+    return a2 / (PI * d * d);
+}
+
+void main()
+{
+    vec2 size = vec2(imageSize(prefiltered));
+    if(any(greaterThanEqual(gl_GlobalInvocationID.xy, uvec2(size))))
+        return;
+    vec3 n = cubeDirection(gl_GlobalInvocationID, size);
+    // solid angle of a base level texel
+    float texelAngle = 4.0 * PI / (6.0 * environmentSize * environmentSize);
+
+    if(roughness <= 0.0)
+    {
+        // a mirror: the environment filtered down to this level's resolution
+        float level = max(log2(environmentSize / size.x), 0.0);
+        imageStore(prefiltered, ivec3(gl_GlobalInvocationID), vec4(textureLod(environment, n, level).rgb, 1.0));
+        return;
+    }
+
+    float alpha = roughness * roughness;
+    vec3 color = vec3(0.0);
+    float weight = 0.0;
+    for(uint i = 0u; i < uint(ENV_PREFILTER_SAMPLES); i++)
+    {
+        vec3 h = importanceSampleGGX(hammersley(i, uint(ENV_PREFILTER_SAMPLES)), n, alpha);
+        vec3 l = reflect(-n, h);
+        float nDotL = dot(n, l);
+        if(nDotL <= 0.0)
+            continue;
+        // reads the level whose texels cover the sample's solid angle, so few samples
+        // leave no noise (filtered importance sampling)
+        float nDotH = max(dot(n, h), 0.0);
+        float pdf = distributionGGX(nDotH, alpha) * 0.25;
+        float sampleAngle = 1.0 / (float(ENV_PREFILTER_SAMPLES) * pdf + 1e-4);
+        float level = max(0.5 * log2(sampleAngle / texelAngle) + 1.0, 0.0);
+        color += textureLod(environment, l, level).rgb * nDotL;
+        weight += nDotL;
+    }
+    imageStore(prefiltered, ivec3(gl_GlobalInvocationID), vec4(color / max(weight, 1e-4), 1.0));
+}
@@ -0,0 +1,30 @@
+#version 460 core
+#include "/include/materials.glsl"
+#include "/include/gbuffer.glsl"
+
+layout (location = 0) out vec4 GAlbedoSpecular;
+layout (location = 1) out vec2 GNormal;
+
+in vec2 TexCoords;
+in vec3 Normal;
+in vec3 WorldPos;
+
+#ifdef MATERIAL_TABLE
+flat in uint Material;
+#else
+uniform sampler2D texture_diffuse1;
+#endif
+
+// the surface inputs of model_lighting.fs, lit later by deferred_lighting.fs
+void main()
+{
+#ifdef MATERIAL_TABLE
+    vec3 kd = GL_MaterialDiffuse(Material, TexCoords).rgb;
+#else
+    vec3 kd = vec3(texture(texture_diffuse1, TexCoords));
+#endif
+    float ks = 0.2;
+
+    GAlbedoSpecular = vec4(kd, ks);
+    GNormal = GL_EncodeNormal(normalize(Normal));
+}
@@ -0,0 +1,34 @@
+#ifndef BAKEDLIGHT_GLSL
+#define BAKEDLIGHT_GLSL
+
+// lighting of static models baked per vertex by the LightBaker: ambient, the directional
+// light and the static point and spot lights, occluded by the static models. rgb is
+// multiplied by the diffuse color, w is 1 for baked vertices and 0 for the others.
+// every baked object has its own block, so copies of a mesh are lit where each one stands.
+layout(std430, binding = 14) readonly buffer GL_BAKED_LIGHT_BUFFER
+{
+    vec4 GL_BakedVertexLight[];
+};
+
+// per object index: the first pool vertex of its meshes, where its block starts in
+// GL_BakedVertexLight and the vertices it covers, 0 for objects that are not baked
+layout(std430, binding = 15) readonly buffer GL_BAKED_OBJECT_BUFFER
+{
+    uvec4 GL_BakedObjects[];
+};
+
+// vertex is the place in the geometry buffer's vertex pool, its gl_VertexID
+vec4 GL_FetchBakedLight(uint object, uint vertex)
+{
+    if(object >= uint(GL_BakedObjects.length()))
+        return vec4(0.0);
+    uvec4 block = GL_BakedObjects[object];
+    uint local = vertex - block.x;
+    return local < block.z ? GL_BakedVertexLight[block.y + local] : vec4(0.0);
+}
+
+// the baked light of the point shaded by calculateLight, fragment shaders set it before
+// calling it. w is 0 for points that are lit at runtime only.
+vec4 GL_BakedLight = vec4(0.0);
+
+#endif /* BAKEDLIGHT_GLSL */
@@ -0,0 +1,36 @@
+#ifndef DRAWDATA_GLSL
+#define DRAWDATA_GLSL
+
+struct GL_DrawData {
+    uint object;
+    uint id;
+    // index into GL_Material, see materials.glsl
+    uint material;
+    // bytes per index of the draw's index pool
+    uint indexSize;
+};
+
+// transforms are computed once per frame on the CPU, shared by all passes
+struct GL_ObjectData {
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+layout(std430, binding = 3) buffer GL_DRAWDATA_BUFFER
+{
+    GL_DrawData GL_Draw[];
+};
+
+layout(std430, binding = 4) buffer GL_OBJECTDATA_BUFFER
+{
+    GL_ObjectData GL_Object[];
+};
+
+// index of the current multi-draw's first command in GL_Draw
+uniform uint GL_DrawOffset;
+
+// only valid in vertex shaders, gl_DrawID is not available later in the pipeline
+#define GL_DRAW_INDEX (GL_DrawOffset + uint(gl_DrawID))
+#define GL_DRAW_OBJECT (GL_Object[GL_Draw[GL_DRAW_INDEX].object])
+
+#endif /* DRAWDATA_GLSL */
@@ -0,0 +1,46 @@
+#ifndef FRAME_GLSL
+#define FRAME_GLSL
+
+// camera and lighting constants, updated once per frame and shared by all programs
+layout(std140, binding = 0) uniform GL_FRAME_CONSTANTS
+{
+    mat4 GL_Projection;
+    mat4 GL_View;
+    mat4 GL_ViewProjection;
+    vec4 GL_CameraPos;
+    // xy: size in pixels, zw: 1 / size
+    vec4 GL_ScreenResolution;
+    vec4 GL_AmbientLight;
+    vec4 GL_DirectionalLightDirection;
+    // rgb: color, a: intensity
+    vec4 GL_DirectionalLightColor;
+    // x: point lights, y: spot lights
+    uvec4 GL_LightCount;
+    // x: near plane, y: far plane
+    vec4 GL_CameraClip;
+    mat4 GL_InverseViewProjection;
+    // irradiance of the sky / pi as 9 SH coefficients, premultiplied by the basis
+    // constants and the cosine lobe, see GL_AmbientIrradiance
+    vec4 GL_AmbientSH[9];
+};
+
+// sky irradiance / pi reaching a surface facing n, 1 for a white sky
+vec3 GL_AmbientIrradiance(vec3 n)
+{
+    vec3 result = GL_AmbientSH[0].rgb
+        + GL_AmbientSH[1].rgb * n.y + GL_AmbientSH[2].rgb * n.z + GL_AmbientSH[3].rgb * n.x
+        + GL_AmbientSH[4].rgb * (n.x * n.y) + GL_AmbientSH[5].rgb * (n.y * n.z)
+        + GL_AmbientSH[6].rgb * (3.0 * n.z * n.z - 1.0)
+        + GL_AmbientSH[7].rgb * (n.x * n.z) + GL_AmbientSH[8].rgb * (n.x * n.x - n.y * n.y);
+    return max(result, vec3(0.0));
+}
+
+// ambient and the directional light's diffuse term, unshadowed, to be multiplied by the
+// diffuse color. cheap enough per vertex, for shading that does not need the lights.
+vec3 GL_VertexLight(vec3 n)
+{
+    float diffuse = max(dot(-GL_DirectionalLightDirection.xyz, n) + 0.1, 0.0);
+    return GL_AmbientLight.rgb * GL_AmbientIrradiance(n) + diffuse * GL_DirectionalLightColor.a * GL_DirectionalLightColor.rgb;
+}
+
+#endif /* FRAME_GLSL */
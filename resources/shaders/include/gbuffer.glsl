@@ -0,0 +1,35 @@
+#ifndef GBUFFER_GLSL
+#define GBUFFER_GLSL
+
+#include "/include/frame.glsl"
+
+// G-buffer of the deferred path, see deferredRenderer.hpp:
+// 0: rgb albedo, a specular (RGBA8)
+// 1: octahedral normal (RG16_SNORM)
+// depth: window depth, positions are rebuilt from it
+
+vec2 GL_EncodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n.z >= 0.0 ? n.xy : folded;
+}
+
+vec3 GL_DecodeNormal(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// world position of a pixel center in window coordinates and its window depth
+vec3 GL_WorldFromDepth(vec2 fragCoord, float depth)
+{
+    vec4 ndc = vec4(fragCoord * GL_ScreenResolution.zw * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 world = GL_InverseViewProjection * ndc;
+    return world.xyz / world.w;
+}
+
+#endif /* GBUFFER_GLSL */
@@ -1,98 +1,168 @@
 #ifndef LIGHT_GLSL
 #define LIGHT_GLSL
 
-struct PointLight {
-    vec4 position;
-    vec4 color;
-    float intensity;
-};
-
-struct DirectionalLight {
-    vec3 direction;
-    vec3 color;
-    float intensity;
-};
-
-struct SpotLight {
-    vec4 position;
-    vec4 direction;
-    vec4 color;
-    float intensity;
-    float cutOff;
-    float outerCutOff;
-};
+#include "/include/lightData.glsl"
+#ifdef LIGHT_CLUSTERS
+#include "/include/lightCluster.glsl"
+#endif
+#ifdef LIGHT_SHADOWS
+#include "/include/shadow.glsl"
+#endif
+#ifdef LIGHT_OBJECT_LISTS
+#include "/include/lightObjects.glsl"
+#endif
+#ifdef LIGHT_BAKED
+#include "/include/bakedLight.glsl"
+#endif
 
 struct Material {
     float kd;
     float ks;
 };
 
-uniform uint GL_Num_PointLight;
-uniform uint GL_Num_SpotLight;
+// fades a light out towards its range, so the cut-off leaves no visible edge.
+// x: distance / range
+float lightWindow(float x)
+{
+    float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);
+    return window * window;
+}
 
-uniform vec3 GL_AmbientLight;
-uniform DirectionalLight GL_DirectionalLight;
+vec3 blinnPhong(vec3 lightDir, vec3 normal, vec3 viewDir, vec3 kd, vec3 ks)
+{
+    vec3 halfDir = normalize(lightDir + viewDir);
+    return kd * max(dot(lightDir, normal) + 0.1, 0) + ks * pow(max(dot(halfDir, normal), 0), 8);
+}
 
-layout(std430, binding=0) buffer GL_POINTLIGHT_BUFFER
+// static lights are part of the baked light
+bool skipStaticLight(uint flags)
 {
-    PointLight GL_PointLight[];
-};
+#ifdef LIGHT_BAKED
+    return GL_BakedLight.w > 0.0 && (flags & LIGHT_FLAG_STATIC) != 0u;
+#else
+    return false;
+#endif
+}
 
-layout(std430, binding=1) buffer GL_SPOTLIGHT_BUFFER
+vec3 pointLight(uint i, vec3 pos, vec3 normal, vec3 viewDir, vec3 kd, vec3 ks)
 {
-    SpotLight GL_SpotLight[];
-};
+    PointLight light = GL_PointLight[i];
+    if(skipStaticLight(light.flags))
+        return vec3(0.0);
+    vec3 toLight = light.position.xyz - pos;
+    float distance = length(toLight);
+    vec3 lightDir = toLight / distance;
+    float intensity = lightWindow(distance * light.color.w) / (distance * distance);
+    return blinnPhong(lightDir, normal, viewDir, kd, ks) * intensity * light.color.rgb;
+}
 
-// viewDir: pos ==> camera
-vec3 calculateLight(vec3 pos, vec3 normal, vec3 viewDir, vec3 kd, vec3 ks)
+vec3 spotLight(uint i, vec3 pos, vec3 normal, vec3 viewDir, vec3 kd, vec3 ks)
 {
+    SpotLight light = GL_SpotLight[i];
+    if(skipStaticLight(light.flags))
+        return vec3(0.0);
+    vec3 toLight = light.position.xyz - pos;
+    float distance = length(toLight);
+    vec3 lightDir = toLight / distance;
+    // 1 inside the inner cone, fading to 0 at the outer one
+    float spotEffect = clamp((dot(-light.direction.xyz, lightDir) - light.direction.w) * light.invCutOffRange, 0.0, 1.0);
+    float intensity = spotEffect * lightWindow(distance * light.color.w) / (distance * distance);
+#ifdef LIGHT_SHADOWS
+    if(intensity > 0.0)
+        intensity *= GL_ShadowFactor(light.shadow, pos, normal);
+#endif
+    return blinnPhong(lightDir, normal, viewDir, kd, ks) * intensity * light.color.rgb;
+}
+
+// ambient and directional light only, without the point and spot lights. baked points
+// get their baked light instead.
+vec3 calculateDirectionalLight(vec3 pos, vec3 normal, vec3 viewDir, vec3 kd, vec3 ks)
+{
+#ifdef LIGHT_BAKED
+    if(GL_BakedLight.w > 0.0)
+        return kd * GL_BakedLight.rgb;
+#endif
     // here is a simple blinn-phong model
-    vec3 result = kd * GL_AmbientLight;
+    vec3 result = kd * GL_AmbientLight.rgb * GL_AmbientIrradiance(normal);
     if(dot(viewDir, normal) <= 0)
         return result;
 
-    // calculate directional light
-    vec3 lightDir = -vec3(GL_DirectionalLight.direction);
-    vec3 halfDir = normalize(lightDir + viewDir);
-    float intensity = GL_DirectionalLight.intensity;
-    result += (kd * max(dot(lightDir, normal) + 0.1, 0) + ks * pow(max(dot(halfDir, normal), 0), 8)) * intensity * vec3(GL_DirectionalLight.color);
+    vec3 lightDir = -GL_DirectionalLightDirection.xyz;
+    float intensity = GL_DirectionalLightColor.a;
+#ifdef LIGHT_SHADOWS
+    intensity *= GL_ShadowFactor(0, pos, normal);
+#endif
+    return result + blinnPhong(lightDir, normal, viewDir, kd, ks) * intensity * GL_DirectionalLightColor.rgb;
+}
 
+// viewDir: pos ==> camera. clusterView selects the light clusters of a reflected camera,
+// fragCoord the window position and depth the clusters are looked up with, both only
+// used when LIGHT_CLUSTERS is defined.
+vec3 calculateLight(vec3 pos, vec3 normal, vec3 viewDir, vec3 kd, vec3 ks, uint clusterView, vec3 fragCoord)
+{
+    vec3 result = calculateDirectionalLight(pos, normal, viewDir, kd, ks);
+    if(dot(viewDir, normal) <= 0)
+        return result;
 
-    // calculate point light
-    for(int i = 0; i < GL_Num_PointLight; i++)
+#ifdef LIGHT_CLUSTERS
+    // only the lights binned into the fragment's cluster
+    float near = GL_CameraClip.x;
+    float far = GL_CameraClip.y;
+    float depth = 2.0 * near * far / (far + near - (fragCoord.z * 2.0 - 1.0) * (far - near));
+    vec2 uv = clamp(fragCoord.xy * GL_ScreenResolution.zw, vec2(0.0), vec2(0.999999));
+    uvec2 tile = uvec2(uv * vec2(LIGHT_CLUSTER_X, LIGHT_CLUSTER_Y));
+    uint cluster = GL_ClusterIndex(clusterView, GL_ClusterSlice(depth), tile);
+    uint count = GL_ClusterLightCount[cluster];
+    for(uint i = 0; i < count; i++)
     {
-        float distance = length(vec3(GL_PointLight[i].position) - pos);
-        lightDir = normalize(vec3(GL_PointLight[i].position) - pos);
-        halfDir = normalize(lightDir + viewDir);
-        intensity = GL_PointLight[i].intensity / (distance * distance);
-        result += (kd * max(dot(lightDir, normal) + 0.1, 0) + ks * pow(max(dot(halfDir, normal), 0), 8)) * intensity * vec3(GL_PointLight[i].color);
+        uint light = GL_ClusterLightIndex[cluster * uint(LIGHT_CLUSTER_MAX_LIGHTS) + i];
+        if((light & GL_CLUSTER_SPOT_BIT) != 0)
+            result += spotLight(light & ~GL_CLUSTER_SPOT_BIT, pos, normal, viewDir, kd, ks);
+        else
+            result += pointLight(light, pos, normal, viewDir, kd, ks);
     }
-    
-    // calculate spot light
-    for(int i = 0; i < GL_Num_SpotLight; i++)
+#else
+#ifdef LIGHT_OBJECT_LISTS
+    // only the lights that reach the object, none for an object far from all of them.
+    // objects that were never assigned shade every light below.
+    uint first = GL_LightObject * GL_OBJECT_LIGHT_STRIDE;
+    uint count = GL_LightObject != GL_OBJECT_LIGHT_NONE && first < uint(GL_ObjectLights.length())
+        ? GL_ObjectLights[first] : GL_OBJECT_LIGHT_NONE;
+    if(count != GL_OBJECT_LIGHT_NONE)
     {
-        float distance = length(vec3(GL_SpotLight[i].position) - pos);
-        lightDir = normalize(vec3(GL_SpotLight[i].position) - pos);
-        halfDir = normalize(lightDir + viewDir);
-        float spotEffect = dot(-vec3(GL_SpotLight[i].direction), lightDir);
-        if(spotEffect > cos(GL_SpotLight[i].cutOff))
-        {
-            spotEffect = 1.0;
-        }
-        else if(spotEffect <= cos(GL_SpotLight[i].cutOff) && spotEffect > cos(GL_SpotLight[i].outerCutOff))
+        for(uint i = 1u; i <= count; i++)
         {
-            spotEffect = (spotEffect - cos(GL_SpotLight[i].outerCutOff)) / (cos(GL_SpotLight[i].cutOff) - cos(GL_SpotLight[i].outerCutOff));
+            uint light = GL_ObjectLights[first + i];
+            if((light & GL_OBJECT_LIGHT_SPOT_BIT) != 0)
+                result += spotLight(light & ~GL_OBJECT_LIGHT_SPOT_BIT, pos, normal, viewDir, kd, ks);
+            else
+                result += pointLight(light, pos, normal, viewDir, kd, ks);
         }
-        else
-        {
-            spotEffect = 0;
-        }
-        intensity = spotEffect * GL_SpotLight[i].intensity / (distance * distance);
-        result += (kd * max(dot(lightDir, normal) + 0.1, 0) + ks * pow(max(dot(halfDir, normal), 0), 8)) * intensity * vec3(GL_SpotLight[i].color);
-    }    
+        return result;
+    }
+#endif
+    // calculate point light
+    for(uint i = 0; i < GL_NUM_POINT_LIGHT; i++)
+        result += pointLight(i, pos, normal, viewDir, kd, ks);
+
+    // calculate spot light
+    for(uint i = 0; i < GL_NUM_SPOT_LIGHT; i++)
+        result += spotLight(i, pos, normal, viewDir, kd, ks);
+#endif
 
     return result;
 }
 
+// fragment shaders only, the clusters of the fragment being shaded
+vec3 calculateLight(vec3 pos, vec3 normal, vec3 viewDir, vec3 kd, vec3 ks, uint clusterView)
+{
+    return calculateLight(pos, normal, viewDir, kd, ks, clusterView, gl_FragCoord.xyz);
+}
+
+vec3 calculateLight(vec3 pos, vec3 normal, vec3 viewDir, vec3 kd, vec3 ks)
+{
+    return calculateLight(pos, normal, viewDir, kd, ks, 0u);
+}
+
 
-#endif /* LIGHT_GLSL */
\ No newline at end of file
+#endif /* LIGHT_GLSL */
@@ -0,0 +1,44 @@
+#ifndef LIGHTCLUSTER_GLSL
+#define LIGHTCLUSTER_GLSL
+
+#include "/include/frame.glsl"
+
+// lights binned into a froxel grid of LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y screen tiles and
+// LIGHT_CLUSTER_Z exponential depth slices, see light_cluster.cs. view 0 is the camera,
+// view i + 1 the camera with the lights reflected in GL_ReflectPlane[i].
+
+// spot light indices are flagged, point light indices are stored as they are
+#define GL_CLUSTER_SPOT_BIT 0x80000000u
+
+layout(std430, binding = 6) buffer GL_CLUSTER_COUNT_BUFFER
+{
+    uint GL_ClusterLightCount[];
+};
+
+layout(std430, binding = 7) buffer GL_CLUSTER_INDEX_BUFFER
+{
+    uint GL_ClusterLightIndex[];
+};
+
+// view space depth at the start of slice
+float GL_ClusterSliceDepth(uint slice)
+{
+    float near = GL_CameraClip.x;
+    float far = GL_CameraClip.y;
+    return near * pow(far / near, float(slice) / float(LIGHT_CLUSTER_Z));
+}
+
+uint GL_ClusterSlice(float depth)
+{
+    float near = GL_CameraClip.x;
+    float far = GL_CameraClip.y;
+    float slice = log(max(depth, near) / near) / log(far / near) * float(LIGHT_CLUSTER_Z);
+    return min(uint(slice), uint(LIGHT_CLUSTER_Z - 1));
+}
+
+uint GL_ClusterIndex(uint view, uint slice, uvec2 tile)
+{
+    return ((view * uint(LIGHT_CLUSTER_Z) + slice) * uint(LIGHT_CLUSTER_Y) + tile.y) * uint(LIGHT_CLUSTER_X) + tile.x;
+}
+
+#endif /* LIGHTCLUSTER_GLSL */
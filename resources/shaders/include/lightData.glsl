@@ -0,0 +1,58 @@
+#ifndef LIGHTDATA_GLSL
+#define LIGHTDATA_GLSL
+
+#include "/include/frame.glsl"
+
+// packed by LightManager
+struct PointLight {
+    // w: range, the distance at which the light is cut off
+    vec4 position;
+    // color times intensity, w: 1 / range
+    vec4 color;
+    // LIGHT_FLAG_*
+    uint flags;
+};
+
+struct SpotLight {
+    // w: range, the distance at which the light is cut off
+    vec4 position;
+    // color times intensity, w: 1 / range
+    vec4 color;
+    // w: cosine of the outer cut-off
+    vec4 direction;
+    // cosine of the inner cut-off
+    float cosCutOff;
+    // 1 / (cosCutOff - cosine of the outer cut-off)
+    float invCutOffRange;
+    // record in GL_Shadow, -1 without a shadow map
+    int shadow;
+    // LIGHT_FLAG_*
+    uint flags;
+};
+
+// as in light.hpp
+#define LIGHT_FLAG_STATIC 1u
+
+// programs specialized for the scene's light counts get constant loop bounds
+#ifdef LIGHT_POINT_COUNT
+#define GL_NUM_POINT_LIGHT uint(LIGHT_POINT_COUNT)
+#else
+#define GL_NUM_POINT_LIGHT GL_LightCount.x
+#endif
+#ifdef LIGHT_SPOT_COUNT
+#define GL_NUM_SPOT_LIGHT uint(LIGHT_SPOT_COUNT)
+#else
+#define GL_NUM_SPOT_LIGHT GL_LightCount.y
+#endif
+
+layout(std430, binding=0) buffer GL_POINTLIGHT_BUFFER
+{
+    PointLight GL_PointLight[];
+};
+
+layout(std430, binding=1) buffer GL_SPOTLIGHT_BUFFER
+{
+    SpotLight GL_SpotLight[];
+};
+
+#endif /* LIGHTDATA_GLSL */
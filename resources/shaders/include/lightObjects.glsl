@@ -0,0 +1,22 @@
+#ifndef LIGHTOBJECTS_GLSL
+#define LIGHTOBJECTS_GLSL
+
+// the lights whose range reaches an object, assigned on the CPU by LightManager.
+// GL_ObjectLights[object * GL_OBJECT_LIGHT_STRIDE] is the count, the indices follow.
+// spot light indices carry GL_OBJECT_LIGHT_SPOT_BIT. the count of an unassigned object
+// is GL_OBJECT_LIGHT_NONE.
+
+#define GL_OBJECT_LIGHT_STRIDE (1u + uint(LIGHT_OBJECT_MAX_LIGHTS))
+#define GL_OBJECT_LIGHT_SPOT_BIT 0x80000000u
+// fragments of objects without a list shade every light
+#define GL_OBJECT_LIGHT_NONE 0xFFFFFFFFu
+
+layout(std430, binding = 13) readonly buffer GL_OBJECT_LIGHT_BUFFER
+{
+    uint GL_ObjectLights[];
+};
+
+// the object shaded by calculateLight, fragment shaders set it before calling it
+uint GL_LightObject = GL_OBJECT_LIGHT_NONE;
+
+#endif /* LIGHTOBJECTS_GLSL */
@@ -0,0 +1,58 @@
+#ifndef MATERIALS_GLSL
+#define MATERIALS_GLSL
+
+// material textures fetched by material index instead of bound samplers, enabled by the
+// defines of MaterialLibrary. include it before anything else in a stage, the bindless
+// path needs its #extension directive ahead of all declarations.
+#ifdef MATERIAL_TABLE
+
+#ifdef MATERIAL_BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
+
+struct GL_MaterialData {
+    // resident handle of the diffuse texture, bindless path only
+    uvec2 diffuseHandle;
+    // texture array and layer of the diffuse texture, texture array path only
+    uint diffuseArray;
+    uint diffuseLayer;
+};
+
+layout(std430, binding = 5) readonly buffer GL_MATERIAL_BUFFER
+{
+    GL_MaterialData GL_Material[];
+};
+
+#ifndef MATERIAL_BINDLESS
+uniform sampler2DArray GL_MaterialArrays[MATERIAL_ARRAY_COUNT];
+#endif
+
+// materials without a diffuse texture read white. dx and dy are the uv derivatives
+// along the window axes, passes that do not rasterize the surface compute their own.
+vec4 GL_MaterialDiffuseGrad(uint material, vec2 uv, vec2 dx, vec2 dy)
+{
+    GL_MaterialData data = GL_Material[material];
+#ifdef MATERIAL_BINDLESS
+    if(data.diffuseHandle == uvec2(0))
+        return vec4(1.0);
+    return textureGrad(sampler2D(data.diffuseHandle), uv, dx, dy);
+#else
+    // every array is indexed with the loop counter, the index has to be dynamically uniform
+    vec4 color = vec4(1.0);
+    for(int i = 0; i < MATERIAL_ARRAY_COUNT; i++)
+        if(uint(i) == data.diffuseArray)
+            color = textureGrad(GL_MaterialArrays[i], vec3(uv, float(data.diffuseLayer)), dx, dy);
+    return color;
+#endif
+}
+
+// neighbouring fragments may belong to draws of different materials, so the derivatives
+// are taken before the material branches
+vec4 GL_MaterialDiffuse(uint material, vec2 uv)
+{
+    return GL_MaterialDiffuseGrad(material, uv, dFdx(uv), dFdy(uv));
+}
+
+#endif /* MATERIAL_TABLE */
+
+#endif /* MATERIALS_GLSL */
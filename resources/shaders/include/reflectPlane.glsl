@@ -9,13 +9,25 @@ struct GL_PlaneData {
     vec4 color;
     float reflectRate;
     float blurLevel;
+    // the mirror_reflect permutation drawing the reflection: 0 full, 1 directional light
+    // only, 2 lit per vertex
+    int shading;
 };
 
+// programs specialized for the plane count get a sized array and constant loop bounds
+#ifdef REFLECT_PLANE_COUNT
+layout(std430, binding = 2) buffer GL_REFLECTPLANE_BUFFER
+{
+    GL_PlaneData GL_ReflectPlane[REFLECT_PLANE_COUNT];
+};
+#define GL_NUM_REFLECT_PLANE uint(REFLECT_PLANE_COUNT)
+#else
 layout(std430, binding = 2) buffer GL_REFLECTPLANE_BUFFER
 {
     GL_PlaneData GL_ReflectPlane[];
 };
-
 uniform uint GL_Num_ReflectPlane;
+#define GL_NUM_REFLECT_PLANE GL_Num_ReflectPlane
+#endif
 
 #endif /* REFLECTPLANE_GLSL */
\ No newline at end of file
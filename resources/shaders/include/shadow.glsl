@@ -0,0 +1,50 @@
+#ifndef SHADOW_GLSL
+#define SHADOW_GLSL
+
+// shadow maps of the directional light and the most important spot lights, packed
+// into one depth atlas, see shadowAtlas.hpp. record 0 is the directional light.
+
+struct GL_ShadowData {
+    mat4 viewProjection;
+    // xy: offset, zw: size of the light's tile in atlas uv
+    vec4 rect;
+    // x: 1 if the record is in use, y: normal offset per unit of clip w
+    vec4 params;
+};
+
+layout(std430, binding = 12) readonly buffer GL_SHADOW_BUFFER
+{
+    GL_ShadowData GL_Shadow[];
+};
+
+uniform sampler2DShadow GL_ShadowAtlas;
+
+// 1 where pos is lit, 0 where it is in shadow. records below 0 are unshadowed lights.
+float GL_ShadowFactor(int record, vec3 pos, vec3 normal)
+{
+    if(record < 0)
+        return 1.0;
+    GL_ShadowData data = GL_Shadow[record];
+    if(data.params.x == 0.0)
+        return 1.0;
+    // the offset grows with the texel footprint, which grows with w under a perspective
+    float w = (data.viewProjection * vec4(pos, 1.0)).w;
+    vec4 clip = data.viewProjection * vec4(pos + normal * data.params.y * w, 1.0);
+    vec3 ndc = clip.xyz / clip.w;
+    if(any(greaterThan(abs(ndc.xy), vec2(1.0))) || ndc.z > 1.0)
+        return 1.0;
+
+    // 2x2 bilinear compares, kept inside the tile
+    vec2 texel = 1.0 / vec2(textureSize(GL_ShadowAtlas, 0));
+    vec2 uv = data.rect.xy + (ndc.xy * 0.5 + 0.5) * data.rect.zw;
+    uv = clamp(uv, data.rect.xy + texel * 1.5, data.rect.xy + data.rect.zw - texel * 1.5);
+    float depth = ndc.z * 0.5 + 0.5;
+    float lit = 0.0;
+    lit += texture(GL_ShadowAtlas, vec3(uv + vec2(-0.5, -0.5) * texel, depth));
+    lit += texture(GL_ShadowAtlas, vec3(uv + vec2( 0.5, -0.5) * texel, depth));
+    lit += texture(GL_ShadowAtlas, vec3(uv + vec2(-0.5,  0.5) * texel, depth));
+    lit += texture(GL_ShadowAtlas, vec3(uv + vec2( 0.5,  0.5) * texel, depth));
+    return lit * 0.25;
+}
+
+#endif /* SHADOW_GLSL */
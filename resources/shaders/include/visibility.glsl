@@ -0,0 +1,25 @@
+#ifndef VISIBILITY_GLSL
+#define VISIBILITY_GLSL
+
+// visibility buffer: every pixel stores the draw and the triangle covering it,
+// see visibilityRenderer.hpp. draw indices are positions in GL_Draw of the pass.
+
+#define GL_VISIBILITY_EMPTY 0xFFFFFFFFu
+#define GL_VISIBILITY_TRIANGLE_MASK ((1u << VISIBILITY_TRIANGLE_BITS) - 1u)
+
+uint GL_PackVisibility(uint draw, uint triangle)
+{
+    return (draw << VISIBILITY_TRIANGLE_BITS) | (triangle & GL_VISIBILITY_TRIANGLE_MASK);
+}
+
+uint GL_VisibilityDraw(uint visibility)
+{
+    return visibility >> VISIBILITY_TRIANGLE_BITS;
+}
+
+uint GL_VisibilityTriangle(uint visibility)
+{
+    return visibility & GL_VISIBILITY_TRIANGLE_MASK;
+}
+
+#endif /* VISIBILITY_GLSL */
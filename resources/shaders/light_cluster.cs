@@ -0,0 +1,79 @@
+#version 460 core
+#include "/include/frame.glsl"
+#include "/include/lightData.glsl"
+#include "/include/lightCluster.glsl"
+#include "/include/reflectPlane.glsl"
+
+// one work group per depth slice and view, one invocation per cluster of the slice.
+// the group walks the lights in chunks that are staged in shared memory.
+layout(local_size_x = LIGHT_CLUSTER_X, local_size_y = LIGHT_CLUSTER_Y, local_size_z = 1) in;
+
+#define GROUP_SIZE (LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y)
+
+// xyz: view space position, w: range
+shared vec4 chunkLights[GROUP_SIZE];
+
+// view space corner of the tile at the given depth
+vec3 tileCorner(vec2 ndc, float depth)
+{
+    return vec3(ndc.x * depth / GL_Projection[0][0], ndc.y * depth / GL_Projection[1][1], -depth);
+}
+
+void main()
+{
+    uint slice = gl_WorkGroupID.z % uint(LIGHT_CLUSTER_Z);
+    uint view = gl_WorkGroupID.z / uint(LIGHT_CLUSTER_Z);
+    uvec2 tile = gl_LocalInvocationID.xy;
+    uint cluster = GL_ClusterIndex(view, slice, tile);
+
+    // view space bounds of the cluster
+    vec2 ndcMin = vec2(tile) / vec2(LIGHT_CLUSTER_X, LIGHT_CLUSTER_Y) * 2.0 - 1.0;
+    vec2 ndcMax = vec2(tile + 1u) / vec2(LIGHT_CLUSTER_X, LIGHT_CLUSTER_Y) * 2.0 - 1.0;
+    float nearDepth = GL_ClusterSliceDepth(slice);
+    float farDepth = GL_ClusterSliceDepth(slice + 1u);
+    vec3 corners[4] = vec3[](tileCorner(ndcMin, nearDepth), tileCorner(ndcMax, nearDepth),
+                             tileCorner(ndcMin, farDepth), tileCorner(ndcMax, farDepth));
+    vec3 boundsMin = min(min(corners[0], corners[1]), min(corners[2], corners[3]));
+    vec3 boundsMax = max(max(corners[0], corners[1]), max(corners[2], corners[3]));
+
+    uint pointCount = GL_LightCount.x;
+    uint lightCount = pointCount + GL_LightCount.y;
+    uint count = 0;
+    for(uint first = 0; first < lightCount; first += uint(GROUP_SIZE))
+    {
+        // stage a chunk, reflected into the view's mirror
+        uint light = first + gl_LocalInvocationIndex;
+        if(light < lightCount)
+        {
+            bool spot = light >= pointCount;
+            // w: range
+            vec4 record = spot ? GL_SpotLight[light - pointCount].position : GL_PointLight[light].position;
+            vec3 position = record.xyz;
+            float range = record.w;
+            if(view > 0u)
+            {
+                vec3 planePos = GL_ReflectPlane[view - 1u].position.xyz;
+                vec3 planeNormal = GL_ReflectPlane[view - 1u].normal.xyz;
+                position -= 2.0 * dot(position - planePos, planeNormal) * planeNormal;
+            }
+            chunkLights[gl_LocalInvocationIndex] = vec4((GL_View * vec4(position, 1.0)).xyz, range);
+        }
+        barrier();
+
+        uint chunkSize = min(uint(GROUP_SIZE), lightCount - first);
+        for(uint i = 0; i < chunkSize && count < uint(LIGHT_CLUSTER_MAX_LIGHTS); i++)
+        {
+            // sphere against box
+            vec4 sphere = chunkLights[i];
+            vec3 closest = clamp(sphere.xyz, boundsMin, boundsMax);
+            vec3 offset = closest - sphere.xyz;
+            if(dot(offset, offset) > sphere.w * sphere.w)
+                continue;
+            uint index = first + i;
+            GL_ClusterLightIndex[cluster * uint(LIGHT_CLUSTER_MAX_LIGHTS) + count] = index < pointCount ? index : (index - pointCount) | GL_CLUSTER_SPOT_BIT;
+            count++;
+        }
+        barrier();
+    }
+    GL_ClusterLightCount[cluster] = count;
+}
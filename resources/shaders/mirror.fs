@@ -1,5 +1,4 @@
 #version 460 core
-#extension GL_ARB_shading_language_include : require
 #include "/include/light.glsl"
 #include "/include/reflectPlane.glsl"
 
@@ -8,40 +7,46 @@ out vec4 FragColor;
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 WorldPos;
+flat in uint PlaneId;
 
 uniform sampler2D texture_diffuse1;
 // uniform sampler2D texture_specular1;
 uniform samplerCube texture_skybox;
 uniform sampler2D texture_reflect;
 
-uniform vec3 cameraPos;
-uniform vec2 screenResolution;
-
-uniform uint planeId;
+// 0 when no mirror is blurred, the reflection is then sampled at the base level
+#ifndef MIRROR_BLUR
+#define MIRROR_BLUR 1
+#endif
 
 float fresnelSchlick(float cosTheta, float refIndex);
 
 void main()
 {    
-    vec3 norm = GL_ReflectPlane[planeId].normal.xyz;
+    vec3 norm = GL_ReflectPlane[PlaneId].normal.xyz;
     vec3 kd = vec3(texture(texture_diffuse1, TexCoords));
     vec3 ks = vec3(0.2);
     // vec3 ks = vec3(texture(texture_specular1, TexCoords));
 
-    vec2 screenCoords = gl_FragCoord.xy / screenResolution;
+    vec2 screenCoords = gl_FragCoord.xy * GL_ScreenResolution.zw;
 
-    float blurLevel = GL_ReflectPlane[planeId].blurLevel;
+#if MIRROR_BLUR
+    float blurLevel = GL_ReflectPlane[PlaneId].blurLevel;
+#else
+    const float blurLevel = 0.0;
+#endif
     vec4 reflectData = textureLod(texture_reflect, screenCoords, blurLevel);
-    vec3 reflectColor = GL_ReflectPlane[planeId].color.xyz;
-    vec3 skyColor = textureLod(texture_skybox, reflect(WorldPos - cameraPos, norm), blurLevel).xyz;
+    vec3 reflectColor = GL_ReflectPlane[PlaneId].color.xyz;
+    // the sky is prefiltered per level for a rougher surface, one fetch gives the blurred reflection
+    vec3 skyColor = textureLod(texture_skybox, reflect(WorldPos - GL_CameraPos.xyz, norm), blurLevel).xyz;
 
     reflectColor *= mix(reflectData.xyz, skyColor, 1 - reflectData.a);
 
-    // reflectColor *=  fresnelSchlick(abs(dot(norm, normalize(cameraPos - WorldPos))), 0.2);
+    // reflectColor *=  fresnelSchlick(abs(dot(norm, normalize(GL_CameraPos.xyz - WorldPos))), 0.2);
 
-    vec3 baseColor = calculateLight(WorldPos, norm, normalize(cameraPos - WorldPos), kd, ks);
+    vec3 baseColor = calculateLight(WorldPos, norm, normalize(GL_CameraPos.xyz - WorldPos), kd, ks);
 
-    float reflectRate = GL_ReflectPlane[planeId].reflectRate;
+    float reflectRate = GL_ReflectPlane[PlaneId].reflectRate;
     FragColor = vec4(mix(reflectColor, baseColor, 1 - reflectRate), 1.0);
 }
 
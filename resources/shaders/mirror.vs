@@ -1,4 +1,6 @@
 #version 460 core
+#include "/include/drawData.glsl"
+#include "/include/frame.glsl"
 
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
@@ -7,17 +9,15 @@ layout (location = 2) in vec2 aTexCoords;
 out vec2 TexCoords;
 out vec3 Normal;
 out vec3 WorldPos;
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+flat out uint PlaneId;
 
 void main()
 {
+    mat4 model = GL_DRAW_OBJECT.model;
     TexCoords = aTexCoords;    
-    mat4 transform = projection * view * model;
+    mat4 transform = GL_ViewProjection * model;
     gl_Position = transform * vec4(aPos, 1.0);
-    mat3 normalMat = transpose(inverse(mat3(model)));
-    Normal = normalize(normalMat * aNormal); 
+    Normal = normalize(mat3(GL_DRAW_OBJECT.normalMatrix) * aNormal);
     WorldPos = vec3(model * vec4(aPos, 1.0));
+    PlaneId = GL_Draw[GL_DRAW_INDEX].id;
 }
\ No newline at end of file
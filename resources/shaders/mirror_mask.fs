@@ -2,9 +2,9 @@
 
 layout(location = 0) out float FragColor;
 
-uniform uint maskId;
+flat in uint MaskId;
 
 void main()
 {    
-    FragColor = (float(maskId) + 1.0) / 255.0;
+    FragColor = (float(MaskId) + 1.0) / 255.0;
 }
\ No newline at end of file
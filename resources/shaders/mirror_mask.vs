@@ -1,14 +1,15 @@
 #version 460 core
+#include "/include/drawData.glsl"
+#include "/include/frame.glsl"
 
+// only positions are fetched: the mask pass uses the mesh's depth stream
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec2 aTexCoords;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+flat out uint MaskId;
 
 void main()
 {  
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-}
\ No newline at end of file
+    mat4 model = GL_DRAW_OBJECT.model;
+    gl_Position = GL_ViewProjection * model * vec4(aPos, 1.0);
+    MaskId = GL_Draw[GL_DRAW_INDEX].id;
+}
@@ -1,5 +1,5 @@
 #version 460 core
-#extension GL_ARB_shading_language_include : require
+#include "/include/materials.glsl"
 #include "/include/light.glsl"
 #include "/include/reflectPlane.glsl"
 
@@ -10,27 +10,54 @@ in vec3 gNormal;
 in vec3 gWorldPos;
 in float maskId;
 
+#ifdef MATERIAL_TABLE
+flat in uint gMaterial;
+#else
 uniform sampler2D texture_diffuse1;
+#endif
+#ifdef LIGHT_OBJECT_LISTS
+flat in uint gLightObject;
+#endif
+#if REFLECT_SHADING == 2
+in vec3 gLighting;
+#elif defined(LIGHT_BAKED)
+in vec4 gBakedLight;
+#endif
 // uniform sampler2D texture_specular1;
 uniform sampler2D texture_mask;
 
-uniform vec3 cameraPos;
-uniform vec2 screenResolution;
-
 void main()
 {   
-    vec2 screenCoords = gl_FragCoord.xy / screenResolution;
+    vec2 screenCoords = gl_FragCoord.xy * GL_ScreenResolution.zw;
     float id = texture(texture_mask, screenCoords).r * 255.0 - 1.0;
     if(abs(id - maskId) > 1e-3)
         discard;
     int planeId = int(id + 0.5);
-    planeId = clamp(planeId, 0, int(GL_Num_ReflectPlane)-1);
+    planeId = clamp(planeId, 0, int(GL_NUM_REFLECT_PLANE)-1);
+    vec3 cameraPos = GL_CameraPos.xyz;
     vec3 viewPos = cameraPos - 2 * dot(cameraPos - GL_ReflectPlane[planeId].position.xyz, GL_ReflectPlane[planeId].normal.xyz) * GL_ReflectPlane[planeId].normal.xyz;
 
     vec3 norm = normalize(gNormal);
+#ifdef LIGHT_OBJECT_LISTS
+    GL_LightObject = gLightObject;
+#endif
+#if REFLECT_SHADING != 2 && defined(LIGHT_BAKED)
+    GL_BakedLight = gBakedLight;
+#endif
+#ifdef MATERIAL_TABLE
+    vec3 kd = GL_MaterialDiffuse(gMaterial, gTexCoords).rgb;
+#else
     vec3 kd = vec3(texture(texture_diffuse1, gTexCoords));
+#endif
     vec3 ks = vec3(0.2);
     // vec3 ks = vec3(texture(texture_specular1, TexCoords));
 
-    FragColor = vec4(calculateLight(gWorldPos, norm, normalize(viewPos-gWorldPos), kd, ks), 1.0);
+#if REFLECT_SHADING == 2
+    FragColor = vec4(kd * gLighting, 1.0);
+#elif REFLECT_SHADING == 1
+    FragColor = vec4(calculateDirectionalLight(gWorldPos, norm, normalize(viewPos-gWorldPos), kd, ks), 1.0);
+#else
+    // lights are culled against the reflected camera of the plane
+    FragColor = vec4(calculateLight(gWorldPos, norm, normalize(viewPos-gWorldPos), kd, ks, uint(planeId) + 1u), 1.0);
+#endif
 }
@@ -1,6 +1,6 @@
 #version 460 core
-#extension GL_ARB_shading_language_include : require
 #include "/include/reflectPlane.glsl"
+#include "/include/frame.glsl"
 
 layout(triangles) in;
 layout(triangle_strip, max_vertices = 30) out;
@@ -13,11 +13,22 @@ out vec2 gTexCoords;
 out vec3 gNormal;
 out vec3 gWorldPos;
 out float maskId;
+#ifdef MATERIAL_TABLE
+flat in uint Material[];
+flat out uint gMaterial;
+#endif
+#ifdef LIGHT_OBJECT_LISTS
+flat in uint LightObject[];
+flat out uint gLightObject;
+#endif
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform vec3 cameraPos;
+#if REFLECT_SHADING == 2
+in vec3 Lighting[];
+out vec3 gLighting;
+#elif defined(LIGHT_BAKED)
+in vec4 BakedLight[];
+out vec4 gBakedLight;
+#endif
 
 void main()
 {
@@ -25,14 +36,18 @@ void main()
     vec3 v1 = WorldPos[1];
     vec3 v2 = WorldPos[2];
 
-    mat4 transform = projection * view;
+    mat4 transform = GL_ViewProjection;
+    vec3 cameraPos = GL_CameraPos.xyz;
 
-    for(int i = 0; i < GL_Num_ReflectPlane; i++)
+    for(int i = 0; i < GL_NUM_REFLECT_PLANE; i++)
     {
         vec3 pos = GL_ReflectPlane[i].position.xyz;
         vec3 normal = GL_ReflectPlane[i].normal.xyz;
         if(dot(cameraPos - pos, normal) < 0)
             continue;
+        // each shading level draws only the mirrors using it
+        if(GL_ReflectPlane[i].shading != REFLECT_SHADING)
+            continue;
 
         float d0 = dot(v0 - pos, normal);
         float d1 = dot(v1 - pos, normal);
@@ -47,6 +62,17 @@ void main()
         gNormal = Normal[0];
         gWorldPos = WorldPos[0];
         maskId = i;
+#ifdef MATERIAL_TABLE
+        gMaterial = Material[0];
+#endif
+#ifdef LIGHT_OBJECT_LISTS
+        gLightObject = LightObject[0];
+#endif
+#if REFLECT_SHADING == 2
+        gLighting = Lighting[0];
+#elif defined(LIGHT_BAKED)
+        gBakedLight = BakedLight[0];
+#endif
         EmitVertex();
 
         // point 2
@@ -56,6 +82,17 @@ void main()
         gNormal = Normal[1];
         gWorldPos = WorldPos[1];
         maskId = i;
+#ifdef MATERIAL_TABLE
+        gMaterial = Material[1];
+#endif
+#ifdef LIGHT_OBJECT_LISTS
+        gLightObject = LightObject[1];
+#endif
+#if REFLECT_SHADING == 2
+        gLighting = Lighting[1];
+#elif defined(LIGHT_BAKED)
+        gBakedLight = BakedLight[1];
+#endif
         EmitVertex();
 
         // point 3
@@ -65,6 +102,17 @@ void main()
         gNormal = Normal[2];
         gWorldPos = WorldPos[2];
         maskId = i;
+#ifdef MATERIAL_TABLE
+        gMaterial = Material[2];
+#endif
+#ifdef LIGHT_OBJECT_LISTS
+        gLightObject = LightObject[2];
+#endif
+#if REFLECT_SHADING == 2
+        gLighting = Lighting[2];
+#elif defined(LIGHT_BAKED)
+        gBakedLight = BakedLight[2];
+#endif
         EmitVertex();
         EndPrimitive();
     }
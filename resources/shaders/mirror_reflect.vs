@@ -1,4 +1,9 @@
 #version 460 core
+#include "/include/drawData.glsl"
+#include "/include/frame.glsl"
+#ifdef LIGHT_BAKED
+#include "/include/bakedLight.glsl"
+#endif
 
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
@@ -7,17 +12,43 @@ layout (location = 2) in vec2 aTexCoords;
 out vec2 TexCoords;
 out vec3 Normal;
 out vec3 WorldPos;
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#ifdef MATERIAL_TABLE
+flat out uint Material;
+#endif
+#ifdef LIGHT_OBJECT_LISTS
+flat out uint LightObject;
+#endif
+#if REFLECT_SHADING == 2
+// lit per vertex, times the diffuse color
+out vec3 Lighting;
+#elif defined(LIGHT_BAKED)
+out vec4 BakedLight;
+#endif
 
 void main()
 {
+    mat4 model = GL_DRAW_OBJECT.model;
     TexCoords = aTexCoords;    
-    mat4 transform = projection * view * model;
+    mat4 transform = GL_ViewProjection * model;
     gl_Position = transform * vec4(aPos, 1.0);
-    mat3 normalMat = transpose(inverse(mat3(model)));
-    Normal = normalize(normalMat * aNormal); 
+    Normal = normalize(mat3(GL_DRAW_OBJECT.normalMatrix) * aNormal);
     WorldPos = vec3(model * vec4(aPos, 1.0));
+#ifdef MATERIAL_TABLE
+    Material = GL_Draw[GL_DRAW_INDEX].material;
+#endif
+#ifdef LIGHT_OBJECT_LISTS
+    LightObject = GL_Draw[GL_DRAW_INDEX].object;
+#endif
+#if defined(LIGHT_BAKED)
+    vec4 baked = GL_FetchBakedLight(GL_Draw[GL_DRAW_INDEX].object, uint(gl_VertexID));
+#endif
+#if REFLECT_SHADING == 2
+#ifdef LIGHT_BAKED
+    Lighting = baked.w > 0.0 ? baked.rgb : GL_VertexLight(Normal);
+#else
+    Lighting = GL_VertexLight(Normal);
+#endif
+#elif defined(LIGHT_BAKED)
+    BakedLight = baked;
+#endif
 }
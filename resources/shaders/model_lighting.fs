@@ -1,5 +1,5 @@
 #version 460 core
-#extension GL_ARB_shading_language_include : require
+#include "/include/materials.glsl"
 #include "/include/light.glsl"
 
 out vec4 FragColor;
@@ -8,18 +8,36 @@ in vec2 TexCoords;
 in vec3 Normal;
 in vec3 WorldPos;
 
+#ifdef MATERIAL_TABLE
+flat in uint Material;
+#else
 uniform sampler2D texture_diffuse1;
+#endif
+#ifdef LIGHT_OBJECT_LISTS
+flat in uint LightObject;
+#endif
+#ifdef LIGHT_BAKED
+in vec4 BakedLight;
+#endif
 // uniform sampler2D texture_specular1;
 
-uniform vec3 cameraPos;
-
 void main()
 {    
     vec3 norm = normalize(Normal);
+#ifdef LIGHT_OBJECT_LISTS
+    GL_LightObject = LightObject;
+#endif
+#ifdef LIGHT_BAKED
+    GL_BakedLight = BakedLight;
+#endif
+#ifdef MATERIAL_TABLE
+    vec3 kd = GL_MaterialDiffuse(Material, TexCoords).rgb;
+#else
     vec3 kd = vec3(texture(texture_diffuse1, TexCoords));
+#endif
     vec3 ks = vec3(0.2);
     // vec3 ks = vec3(texture(texture_specular1, TexCoords));
 
-    FragColor = vec4(calculateLight(WorldPos, norm, normalize(cameraPos-WorldPos), kd, ks), 1.0);
+    FragColor = vec4(calculateLight(WorldPos, norm, normalize(GL_CameraPos.xyz-WorldPos), kd, ks), 1.0);
 }
 
@@ -0,0 +1,6 @@
+#version 460 core
+
+// depth only
+void main()
+{
+}
@@ -0,0 +1,13 @@
+#version 460 core
+#include "/include/drawData.glsl"
+
+// only positions are fetched: shadow passes use the mesh's depth stream
+layout (location = 0) in vec3 aPos;
+
+// the light of the atlas tile being rendered
+uniform mat4 GL_ShadowViewProjection;
+
+void main()
+{
+    gl_Position = GL_ShadowViewProjection * GL_DRAW_OBJECT.model * vec4(aPos, 1.0);
+}
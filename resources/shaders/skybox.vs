@@ -1,15 +1,13 @@
 #version 460 core
+#include "/include/frame.glsl"
 
 layout (location = 0) in vec3 aPos;
 
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
-
 void main()
 {
     TexCoords = aPos;
-    vec4 pos = projection * mat4(mat3(view)) * vec4(aPos, 1.0);
+    vec4 pos = GL_Projection * mat4(mat3(GL_View)) * vec4(aPos, 1.0);
     gl_Position = pos.xyww;
 }
\ No newline at end of file
@@ -0,0 +1,11 @@
+#version 460 core
+#include "/include/visibility.glsl"
+
+layout (location = 0) out uint Visibility;
+
+flat in uint DrawIndex;
+
+void main()
+{
+    Visibility = GL_PackVisibility(DrawIndex, uint(gl_PrimitiveID));
+}
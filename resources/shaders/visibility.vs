@@ -0,0 +1,13 @@
+#version 460 core
+#include "/include/drawData.glsl"
+#include "/include/frame.glsl"
+
+layout (location = 0) in vec3 aPos;
+
+flat out uint DrawIndex;
+
+void main()
+{
+    gl_Position = GL_ViewProjection * GL_DRAW_OBJECT.model * vec4(aPos, 1.0);
+    DrawIndex = GL_DRAW_INDEX;
+}
@@ -0,0 +1,139 @@
+#version 460 core
+#include "/include/materials.glsl"
+#include "/include/drawData.glsl"
+#include "/include/visibility.glsl"
+#include "/include/light.glsl"
+
+out vec4 FragColor;
+
+uniform usampler2D visibility_ids;
+uniform sampler2D visibility_depth;
+
+// the commands of the visibility pass, indexed like GL_Draw
+struct GL_DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 8) readonly buffer GL_DRAW_COMMAND_BUFFER
+{
+    GL_DrawCommand GL_DrawCommands[];
+};
+
+// the geometry buffer pools: interleaved Vertex, 16 and 32 bit indices
+layout(std430, binding = 9) readonly buffer GL_VERTEX_POOL
+{
+    float GL_Vertices[];
+};
+
+layout(std430, binding = 10) readonly buffer GL_INDEX16_POOL
+{
+    uint GL_Indices16[];
+};
+
+layout(std430, binding = 11) readonly buffer GL_INDEX32_POOL
+{
+    uint GL_Indices32[];
+};
+
+uint fetchIndex(uint index, uint indexSize)
+{
+    if(indexSize == 2u)
+        return (GL_Indices16[index >> 1] >> ((index & 1u) * 16u)) & 0xFFFFu;
+    return GL_Indices32[index];
+}
+
+vec3 fetchVec3(uint vertex, uint offset)
+{
+    uint base = vertex * uint(VISIBILITY_VERTEX_STRIDE) + offset;
+    return vec3(GL_Vertices[base], GL_Vertices[base + 1u], GL_Vertices[base + 2u]);
+}
+
+vec2 fetchVec2(uint vertex, uint offset)
+{
+    uint base = vertex * uint(VISIBILITY_VERTEX_STRIDE) + offset;
+    return vec2(GL_Vertices[base], GL_Vertices[base + 1u]);
+}
+
+float cross2(vec2 a, vec2 b)
+{
+    return a.x * b.y - a.y * b.x;
+}
+
+// perspective correct barycentrics of the point ndc inside the projected triangle
+vec3 barycentrics(vec2 ndc, vec2 p0, vec2 p1, vec2 p2, vec3 invW)
+{
+    float area = cross2(p1 - p0, p2 - p0);
+    float b1 = cross2(ndc - p0, p2 - p0) / area;
+    float b2 = cross2(p1 - p0, ndc - p0) / area;
+    vec3 b = vec3(1.0 - b1 - b2, b1, b2) * invW;
+    return b / (b.x + b.y + b.z);
+}
+
+// every visible pixel is shaded once: the attributes of its triangle are fetched from
+// the geometry buffer and interpolated here instead of in the rasterizer
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    uint visibility = texelFetch(visibility_ids, pixel, 0).r;
+    if(visibility == GL_VISIBILITY_EMPTY)
+        discard;
+    float depth = texelFetch(visibility_depth, pixel, 0).r;
+
+    uint drawIndex = GL_VisibilityDraw(visibility);
+    GL_DrawData draw = GL_Draw[drawIndex];
+    GL_DrawCommand command = GL_DrawCommands[drawIndex];
+    GL_ObjectData object = GL_Object[draw.object];
+    uint first = command.firstIndex + GL_VisibilityTriangle(visibility) * 3u;
+    uint vertices[3];
+    for(uint i = 0u; i < 3u; i++)
+        vertices[i] = uint(int(fetchIndex(first + i, draw.indexSize)) + command.baseVertex);
+
+    // positions in world and clip space
+    vec3 world[3];
+    vec4 clip[3];
+    for(uint i = 0u; i < 3u; i++)
+    {
+        world[i] = vec3(object.model * vec4(fetchVec3(vertices[i], VISIBILITY_POSITION_OFFSET), 1.0));
+        clip[i] = GL_ViewProjection * vec4(world[i], 1.0);
+    }
+    vec3 invW = 1.0 / vec3(clip[0].w, clip[1].w, clip[2].w);
+    vec2 p0 = clip[0].xy * invW.x;
+    vec2 p1 = clip[1].xy * invW.y;
+    vec2 p2 = clip[2].xy * invW.z;
+
+    // the neighbouring pixels give the uv derivatives for texture filtering
+    vec2 ndc = gl_FragCoord.xy * GL_ScreenResolution.zw * 2.0 - 1.0;
+    vec2 pixelSize = 2.0 * GL_ScreenResolution.zw;
+    vec3 b = barycentrics(ndc, p0, p1, p2, invW);
+    vec3 bx = barycentrics(ndc + vec2(pixelSize.x, 0.0), p0, p1, p2, invW);
+    vec3 by = barycentrics(ndc + vec2(0.0, pixelSize.y), p0, p1, p2, invW);
+
+    vec2 uv[3];
+    vec3 normal = vec3(0.0);
+    for(uint i = 0u; i < 3u; i++)
+    {
+        uv[i] = fetchVec2(vertices[i], VISIBILITY_TEXCOORD_OFFSET);
+        normal += b[i] * fetchVec3(vertices[i], VISIBILITY_NORMAL_OFFSET);
+    }
+    vec2 texCoords = b.x * uv[0] + b.y * uv[1] + b.z * uv[2];
+    vec2 dx = bx.x * uv[0] + bx.y * uv[1] + bx.z * uv[2] - texCoords;
+    vec2 dy = by.x * uv[0] + by.y * uv[1] + by.z * uv[2] - texCoords;
+    vec3 pos = b.x * world[0] + b.y * world[1] + b.z * world[2];
+    vec3 norm = normalize(mat3(object.normalMatrix) * normal);
+#ifdef LIGHT_OBJECT_LISTS
+    GL_LightObject = draw.object;
+#endif
+#ifdef LIGHT_BAKED
+    GL_BakedLight = b.x * GL_FetchBakedLight(draw.object, vertices[0]) + b.y * GL_FetchBakedLight(draw.object, vertices[1])
+                  + b.z * GL_FetchBakedLight(draw.object, vertices[2]);
+#endif
+
+    vec3 kd = GL_MaterialDiffuseGrad(draw.material, texCoords, dx, dy).rgb;
+    vec3 ks = vec3(0.2);
+    FragColor = vec4(calculateLight(pos, norm, normalize(GL_CameraPos.xyz - pos), kd, ks, 0u, vec3(gl_FragCoord.xy, depth)), 1.0);
+    gl_FragDepth = depth;
+}
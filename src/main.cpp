@@ -11,13 +11,29 @@
 #include <opengl/light.hpp>
 #include <opengl/skyBox.hpp>
 #include <opengl/reflectPlane.hpp>
-
+#include <opengl/drawQueue.hpp>
+#include <opengl/materialLibrary.hpp>
+#include <opengl/frameConstants.hpp>
+#include <opengl/deferredRenderer.hpp>
+#include <opengl/visibilityRenderer.hpp>
+#include <opengl/shadowAtlas.hpp>
+#include <opengl/lightBaker.hpp>
+#include <opengl/glExtensions.hpp>
+#include <opengl/glState.hpp>
+#include <opengl/ringBuffer.hpp>
+#include <opengl/frameArena.hpp>
+#include <opengl/allocationCounter.hpp>
+
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
+void printOptimizeStats(const Model &model);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
@@ -33,18 +49,47 @@ bool firstMouse = true;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-int main()
+// --frames N: render N frames once all programs are ready, in a hidden window, then exit.
+// the exit code is 1 if any of those frames but the first queried a uniform location or,
+// built with -DCOUNT_ALLOCATIONS=ON, allocated heap memory (string temporaries included).
+// --deferred: shade the scene through the G-buffer of DeferredRenderer.
+// --visibility: shade the scene through the visibility buffer of VisibilityRenderer.
+// --bake: bake the lighting of static models and static lights per vertex with LightBaker.
+// --stats: print the build time of every program, what the mesh optimizer saved per model,
+// the light bake's time and the GL state tracker's and the frame sync's counters once a second.
+int main(int argc, char **argv)
 {
+    unsigned long maxFrames = 0;
+    bool deferredShading = false;
+    bool visibilityShading = false;
+    bool bakeLighting = false;
+    bool printStats = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            maxFrames = strtoul(argv[i + 1], NULL, 10);
+        else if (strcmp(argv[i], "--deferred") == 0)
+            deferredShading = true;
+        else if (strcmp(argv[i], "--visibility") == 0)
+            visibilityShading = true;
+        else if (strcmp(argv[i], "--bake") == 0)
+            bakeLighting = true;
+        else if (strcmp(argv[i], "--stats") == 0)
+            printStats = true;
+    }
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
+    if (maxFrames > 0)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
     // glfw window creation
     // --------------------
@@ -70,13 +115,15 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    GLExtensions::load((GLADloadproc)glfwGetProcAddress);
 
     // configure global opengl state
     // -----------------------------
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_STENCIL_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GLState &glState = GLState::instance();
+    glState.setEnabled(GL_DEPTH_TEST, true);
+    glState.setEnabled(GL_STENCIL_TEST, true);
+    glState.setEnabled(GL_BLEND, true);
+    glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     // set camera view info
     // --------------------
@@ -87,9 +134,17 @@ int main()
 
     // build and compile shaders
     // -------------------------
-    Shader ourShader("../resources/shaders/model_lighting.vs", "../resources/shaders/model_lighting.fs");
-    Shader reflectShader("../resources/shaders/mirror.vs", "../resources/shaders/mirror.fs");
-    Shader skyboxShader("../resources/shaders/skybox.vs", "../resources/shaders/skybox.fs");
+    // all programs are submitted deferred so the driver compiles them while the models
+    // load, the render loop skips passes whose program is not ready yet
+    Shader::verbose = printStats;
+    double shaderStartTime = glfwGetTime();
+    Shader skyboxShader("../resources/shaders/skybox.vs", "../resources/shaders/skybox.fs", nullptr, ShaderDefines(), true);
+
+    // generate a light source
+    LightManager ourLightManager;
+    ourLightManager.enableBakedLighting(bakeLighting);
+    // ourLightManager.addPointLight(glm::vec3(2.0f, 0.0f, 2.0f), glm::vec3(1.0f, 0.0f, 0.0f), 1.0f);
+    // ourLightManager.addSpotLight(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(1.0f, 1.0f, 1.0f), 0.6f, 5.0f, 15.0f);
 
     // load models
     // -----------
@@ -118,17 +173,60 @@ int main()
         mirror.color = glm::vec3(i*0.25 + 0.75);
         // mirror.color = glm::vec3(1.0,0.5,0.5);
         mirror.blurLevel = i * 0.7f;
-        ourReflectPlaneManager.addReflectPlane(mirror);
+        if (printStats)
+            printOptimizeStats(mirror.model);
+        ourReflectPlaneManager.addReflectPlane(std::move(mirror));
 
         Model frame("../resources/models/mirror/classical-mirror/source/frame.fbx", false);
         frame.position = glm::vec3(i * 1.0f - 2.0f, -0.1f, -2.0f);
         frame.scale = glm::vec3(0.02f, 0.02f, 0.02f);
-        modelList.push_back(frame);
+        modelList.push_back(std::move(frame));
     }
-    // generate a light source
-    LightManager ourLightManager;
-    // ourLightManager.addPointLight(glm::vec3(2.0f, 0.0f, 2.0f), glm::vec3(1.0f, 0.0f, 0.0f), 1.0f);
-    // ourLightManager.addSpotLight(glm::vec3(0.0f, 0.0f, 3.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(1.0f, 1.0f, 1.0f), 0.6f, 5.0f, 15.0f);
+    if (printStats)
+        for (const Model &model : modelList)
+            printOptimizeStats(model);
+    // material textures of everything loaded so far become addressable by material index
+    MaterialLibrary::instance().build();
+
+    // the lit programs are specialized for the scene's lights, materials and mirrors.
+    // selectPrograms picks the permutations again when lights or mirrors change later.
+    ShaderDefines materialDefines = MaterialLibrary::instance().getShaderDefines();
+    ShaderPermutations lightingShaders("../resources/shaders/model_lighting.vs", "../resources/shaders/model_lighting.fs");
+    ShaderPermutations mirrorShaders("../resources/shaders/mirror.vs", "../resources/shaders/mirror.fs");
+    Shader *ourShader = nullptr;
+    Shader *reflectShader = nullptr;
+    std::unique_ptr<DeferredRenderer> deferredRenderer;
+    std::unique_ptr<VisibilityRenderer> visibilityRenderer;
+    if (visibilityShading && !VisibilityRenderer::available())
+        std::cout << "WARNING::VISIBILITYRENDERER::NO_MATERIAL_TABLE, falling back to forward shading" << std::endl;
+    if (visibilityShading && VisibilityRenderer::available())
+        visibilityRenderer.reset(new VisibilityRenderer(ourLightManager.getShaderDefines()));
+    else if (deferredShading)
+        deferredRenderer.reset(new DeferredRenderer(ourLightManager.getShaderDefines(), materialDefines));
+    unsigned long lightDefinesVersion = 0;
+    unsigned long mirrorDefinesVersion = 0;
+    auto selectPrograms = [&]()
+    {
+        lightDefinesVersion = ourLightManager.getDefinesVersion();
+        mirrorDefinesVersion = ourReflectPlaneManager.getDefinesVersion();
+        ShaderDefines lightDefines = ourLightManager.getShaderDefines();
+        if (visibilityRenderer)
+            visibilityRenderer->setLightDefines(lightDefines);
+        else if (deferredRenderer)
+            deferredRenderer->setLightDefines(lightDefines);
+        else
+        {
+            ShaderDefines lightingDefines = lightDefines;
+            lightingDefines.insert(materialDefines.begin(), materialDefines.end());
+            ourShader = &lightingShaders.get(lightingDefines, true);
+        }
+        // the mirror programs are specialized for the planes as well
+        ShaderDefines mirrorDefines = ourReflectPlaneManager.getShaderDefines();
+        mirrorDefines.insert(lightDefines.begin(), lightDefines.end());
+        reflectShader = &mirrorShaders.get(mirrorDefines, true);
+    };
+    selectPrograms();
+    ourReflectPlaneManager.prepareShaders(ourLightManager);
 
     // generate skybox
     SkyBox ourSkyBox;
@@ -140,14 +238,47 @@ int main()
         "../resources/textures/skybox/front.jpg",
         "../resources/textures/skybox/back.jpg"
     }, false);
+    // ambient light follows the sky's colors
+    ourLightManager.setAmbientIrradiance(ourSkyBox.irradiance);
+
+    // static lighting of the models that do not move, after the lights and the sky are set
+    std::unique_ptr<LightBaker> lightBaker;
+    if (bakeLighting)
+    {
+        lightBaker.reset(new LightBaker());
+        lightBaker->bake(ourLightManager, modelList);
+        if (printStats)
+            std::cout << "Light bake: " << lightBaker->bakedVertices << " vertices, " << lightBaker->occluders
+                      << " occluders on " << lightBaker->threadCount << " threads in " << lightBaker->milliseconds
+                      << " ms" << std::endl;
+    }
+
+    // the main pass submits all its draws through one queue
+    DrawQueue mainQueue;
+    // camera and lighting uniforms shared by all programs
+    FrameConstants frameConstants;
 
     // draw in wireframe
     // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(window))
+    unsigned long readyFrames = 0;
+    unsigned long allocatingFrames = 0;
+    unsigned long queryingFrames = 0;
+    bool shadersReported = false;
+    double lastStateReport = 0.0;
+    while (!glfwWindowShouldClose(window) && (maxFrames == 0 || readyFrames < maxFrames))
     {
+        unsigned long locationQueries = Shader::locationQueries;
+        unsigned long allocations = AllocationCounter::allocations();
+        bool shadersBuilding = Shader::pendingPrograms > 0;
+        glState.beginFrame();
+        // transient data of the last frame is released
+        FrameArena::instance().reset();
+        // the ring buffer regions of this frame are free once the GPU finished the frame that used them last
+        FrameSync::beginFrame();
+
         // per-frame time logic
         // --------------------
         float currentFrame = static_cast<float>(glfwGetTime());
@@ -163,24 +294,103 @@ int main()
         glClearColor(0.35f, 0.35f, 0.35f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
+        // camera and lights, once for every program
+        frameConstants.update(camera, ourLightManager);
+        // this frame's transforms, the mirrors' ones with the plane data
+        ourModel.updateTransform();
+        for (Model &model : modelList)
+            model.updateTransform();
+        ourReflectPlaneManager.updatePlanes(camera);
+        // their changes are copied once, for every pass of the frame
+        ObjectBuffer::instance().flush();
+        // lights or mirrors were added or removed: the programs built for the old counts
+        // would ignore them
+        if (ourLightManager.getDefinesVersion() != lightDefinesVersion || ourReflectPlaneManager.getDefinesVersion() != mirrorDefinesVersion)
+            selectPrograms();
+        // shadow maps first, they assign the spot lights' shadow records that Attach uploads
+        if (ourLightManager.usesShadows())
+            ShadowAtlas::instance().update(ourLightManager, camera, modelList);
+        // per-object light lists, used when the lights are not clustered
+        ourLightManager.assignLights(ourModel);
+        for (Model &model : modelList)
+            ourLightManager.assignLights(model);
+        ourLightManager.Attach();
+        // the lights binned for the camera and every mirror
+        ourLightManager.buildClusters(1 + ourReflectPlaneManager.getPlaneCount());
+
         // render the model
-        ourShader.use();
-        ourLightManager.Attach(ourShader);
-        ourShader.setCamera(camera);
-        ourModel.Draw(ourShader);
+        // the three paths draw the same queue
+        bool mainReady = visibilityRenderer ? visibilityRenderer->isReady()
+                       : deferredRenderer ? deferredRenderer->isReady() : ourShader->isReady();
+        if (mainReady)
+        {
+            LodContext mainLod = LodContext::fromCamera(camera);
+            mainQueue.clear();
+            ourModel.Submit(mainQueue, &mainLod);
+            if (visibilityRenderer)
+            {
+                visibilityRenderer->Draw(mainQueue, camera);
+            }
+            else if (deferredRenderer)
+            {
+                deferredRenderer->Draw(mainQueue, camera);
+            }
+            else
+            {
+                ourShader->use();
+                ShadowAtlas::bind(*ourShader);
+                mainQueue.Draw(*ourShader);
+            }
+        }
 
         // render mirror
         ourReflectPlaneManager.generateReflection(camera, ourLightManager, modelList);
-        reflectShader.use();
-        ourLightManager.Attach(reflectShader);
-        ourSkyBox.Attach(reflectShader, 0);
-        reflectShader.setCamera(camera);
-        ourReflectPlaneManager.Draw(reflectShader, 1);
+        if (reflectShader->isReady())
+        {
+            reflectShader->use();
+            ShadowAtlas::bind(*reflectShader);
+            ourSkyBox.Attach(*reflectShader);
+            ourReflectPlaneManager.Draw(*reflectShader);
+        }
 
         // render skybox
-        skyboxShader.use();
-        skyboxShader.setCamera(camera);
-        ourSkyBox.Draw(skyboxShader);
+        if (skyboxShader.isReady())
+        {
+            skyboxShader.use();
+            ourSkyBox.Draw(skyboxShader);
+        }
+
+        if (!shadersReported && Shader::pendingPrograms == 0)
+        {
+            shadersReported = true;
+            std::cout << "Shaders ready: " << Shader::cachedPrograms << " from cache, " << Shader::compiledPrograms
+                      << " compiled, " << (glfwGetTime() - shaderStartTime) * 1000.0 << " ms after submission" << std::endl;
+        }
+
+        // uniform locations, binding tables and buffer capacities are settled after linking
+        // and during the first frame with all programs ready, later frames neither query
+        // GL for names nor allocate
+        bool steadyFrame = !shadersBuilding && readyFrames++ > 0;
+        if (steadyFrame && Shader::locationQueries != locationQueries)
+        {
+            queryingFrames++;
+            std::cout << "WARNING::SHADER::UNIFORM_LOCATION_QUERIES_IN_FRAME: " << Shader::locationQueries - locationQueries << std::endl;
+        }
+        if (steadyFrame && AllocationCounter::allocations() != allocations)
+        {
+            allocatingFrames++;
+            std::cout << "WARNING::FRAME::HEAP_ALLOCATIONS: " << AllocationCounter::allocations() - allocations << std::endl;
+        }
+
+        // redundant state changes dropped by the state cache, once a second
+        if (printStats && currentFrame - lastStateReport >= 1.0)
+        {
+            lastStateReport = currentFrame;
+            std::cout << "GL state: " << glState.lastFrameIssued << " calls issued (" << glState.lastFrameTextureBinds << " texture binds), "
+                      << glState.lastFrameSkipped << " skipped last frame, " << FrameSync::stalls << " frames waited for the GPU" << std::endl;
+        }
+
+        FrameSync::endFrame();
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
@@ -188,10 +398,13 @@ int main()
         glfwPollEvents();
     }
 
+    if (AllocationCounter::enabled())
+        std::cout << "Frames with heap allocations: " << allocatingFrames << " of " << readyFrames << std::endl;
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
-    return 0;
+    return allocatingFrames > 0 || queryingFrames > 0 ? 1 : 0;
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -221,7 +434,7 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
     // make sure the viewport matches the new window dimensions; note that width and 
     // height will be significantly larger than specified on retina displays.
-    glViewport(0, 0, width, height);
+    GLState::instance().viewport(0, 0, width, height);
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -252,4 +465,16 @@ void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
     camera.ProcessMouseScroll(static_cast<float>(yoffset));
-}
\ No newline at end of file
+}
+
+// reports what the import-time optimization of a model's meshes saved
+// ---------------------------------------------------------------------
+void printOptimizeStats(const Model &model)
+{
+    const MeshOptimizeStats &stats = model.getOptimizeStats();
+    std::cout << "Optimized: " << model.path << "\n"
+              << "  vertices: " << stats.verticesBefore << " -> " << stats.verticesAfter << "\n"
+              << "  vertex shader invocations: " << stats.transformsBefore << " -> " << stats.transformsAfter
+              << " (ACMR " << stats.acmrBefore() << " -> " << stats.acmrAfter() << ")\n"
+              << "  index bytes: " << stats.indexBytesBefore << " -> " << stats.indexBytesAfter << std::endl;
+}